@@ -1,8 +1,18 @@
+#define _POSIX_C_SOURCE 200809L
 #include <riv.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "utils.h"
 
 // #define DEBUG_BBOX
 // #define DEBUG_SPRS
+// #define DEBUG_FULL_REDRAW
+// #define DEBUG_STATE_HASH
 
 //------------------------------------------------------------------------------
 // Constants
@@ -11,12 +21,25 @@ enum {
   SCREEN_PIXELS = 256,
   TILE_PIXELS = 16,
   MAP_SIZE = 64,
-  NUM_LEVELS = 4,
+  MAP_PIXELS = MAP_SIZE * TILE_PIXELS,
+  WALL_MASK_WORDS = MAP_PIXELS / 64,
+  CHUNK_PIXELS = SCREEN_PIXELS, // chunks are composited in the framebuffer
+  CHUNK_TILES = CHUNK_PIXELS / TILE_PIXELS,
+  CHUNK_MASK_WORDS = CHUNK_PIXELS / 64,
+  NUM_CHUNKS = MAP_SIZE / CHUNK_TILES,
+  MAX_LEVELS = 16, // level files probed in the cartridge
   MAX_OBJECTS = 4096,
   SPRITESHEET_COLUMNS = 16,
-  SPRITESHEET_GAME = 1,
+  MAX_ANIM_STEPS = 32, // animation frames plus loop delay
 };
 
+typedef enum SPRITESHEET_ID {
+  SPRITESHEET_GAME = 1,
+  SPRITESHEET_GAME_HURT, // black outlines turned red, each hurt copy follows its sheet
+  SPRITESHEET_GAME_GOLD, // slime greens turned gold
+  SPRITESHEET_GAME_GOLD_HURT,
+} SPRITESHEET_ID;
+
 typedef enum MAP_LAYERS {
   MAP_LAYER_GROUND = 0,
   MAP_LAYER_BOTTOM_ITEMS,
@@ -25,8 +48,15 @@ typedef enum MAP_LAYERS {
   MAP_LAYER_TOP_ITEMS,
   MAP_LAYER_EFFECTS,
   NUM_MAP_LAYERS = 5,
+  NUM_DRAW_LAYERS = 6, // map layers plus effects
 } MAP_LAYERS;
 
+typedef enum CHUNK_LAYERS {
+  CHUNK_LAYER_GROUND = 0,
+  CHUNK_LAYER_WALLS,
+  NUM_CHUNK_LAYERS,
+} CHUNK_LAYERS;
+
 typedef enum TYPE_ID {
   TYPE_NONE = 0,
   TYPE_GROUND = (1 << 0),
@@ -39,6 +69,15 @@ typedef enum TYPE_ID {
   NUM_TYPES,
 } TYPE_ID;
 
+typedef enum POOL_ID {
+  POOL_GROUND = 0, // ground without behavior
+  POOL_WALLS, // walls without behavior
+  POOL_DECOR, // items without behavior
+  POOL_ACTORS, // items, triggers and creatures, their update order matters
+  POOL_EFFECTS,
+  NUM_POOLS,
+} POOL_ID;
+
 typedef enum GFX_ID {
   GFX_GROUND_SPIKES = 118,
   GFX_GROUND_SPIKES_HURT = 123,
@@ -70,6 +109,7 @@ typedef enum GFX_ID {
   GFX_EFFECT_ATTACK = 156,
   GFX_EFFECT_DUST = 134,
   GFX_EFFECT_EXPLOSION = 160,
+  GFX_BENCH_WALL = 255, // tile unused by the levels
   NUM_GFX = 256
 } GFX_ID;
 
@@ -102,9 +142,13 @@ typedef struct Thing {
   u8 type; // type id
   u16 spr; // sprite id
   u8 layer; // map layer
+  u8 pool; // pool id
   u16 id; // object id
+  u16 gen; // times its slot was reused
+  u32 seq; // spawn sequence, objects act in this order
   bool removed;
   bool phantom;
+  bool dynamic; // wall that changes at runtime, thus kept out of the wall mask
   u64 spawn_frame;
   vec2 pos; // top left coordinates for the sprite
   vec2 spawn_pos;
@@ -115,6 +159,18 @@ typedef struct Thing {
   u16 spr_frame_duration;
   u16 spr_frames;
   u16 spr_loop_delay;
+  u16 anim; // animation table, the prototype it was spawned from
+  u8 anim_step; // current step in the animation table
+  u64 anim_step_end; // frame when the animation moves to the next step
+  bool indexed; // whether it is linked in the spatial index
+  u16 cell; // spatial index cell
+  u16 cell_prev; // previous object id in the same cell
+  u16 cell_next; // next object id in the same cell
+  bool asleep; // whether it is waiting for the player to come near
+  u16 sleep_cell; // sleeping cell
+  u16 sleep_next; // next sleeping object id in the same cell
+  u64 digest; // its term in the rolling state hash
+  bool touched; // whether it changed in the current frame
 } Thing;
 
 typedef struct Item {
@@ -173,43 +229,235 @@ typedef union Object {
   Effect effect;
 } Object;
 
+typedef struct Handle {
+  u16 id; // object slot
+  u16 gen; // slot generation when the handle was taken
+} Handle;
+
+typedef struct HudKey {
+  i64 health; // -1 without a player
+  i64 coins;
+  i64 secs;
+  i64 banner; // HUD_BANNER_* plus its blink phase, 0 when none
+} HudKey;
+
 //------------------------------------------------------------------------------
 // Data
 
 // Graphics
 Object gfx_objects[NUM_GFX] =
 #include "gfx.h"
+u16 gfx_anims[NUM_GFX][MAX_ANIM_STEPS]; // sprite offset of each animation step, filled on load
 // Sounds
 riv_waveform_desc sfx_descs[NUM_SFX][NUM_SFX_CHANNELS] =
 #include "sfx.h"
-// Maps
-unsigned char maps[NUM_LEVELS][NUM_MAP_LAYERS][MAP_SIZE][MAP_SIZE] =
-#include "maps.h"
+// Maps, one level<n>.bin file per level in the cartridge, memory mapped
+typedef struct Level {
+  const u8 *data;
+  u64 size;
+  atomic_bool checked; // cells validated, done on first use by any game
+} Level;
+Level levels[MAX_LEVELS];
+i64 num_levels; // level files found
+
+//------------------------------------------------------------------------------
+// Profile
+
+// Build with PROFILE defined to count the cycles and calls of the hot paths
+// below, the totals of each frame are kept and summarized when the level
+// changes and when the game ends. Zones nest, so the cycles of a zone include
+// the zones it calls. Without PROFILE zones compile to nothing.
+
+#ifdef PROFILE
+
+enum {
+  ZONE_GAME_UPDATE,
+  ZONE_MAP_UPDATE,
+  ZONE_OBJECT_UPDATE,
+  ZONE_COLLIDES,
+  ZONE_CREATURE_MOVE,
+  ZONE_SPAWN,
+  ZONE_GAME_DRAW,
+  ZONE_MAP_DRAW,
+  ZONE_HUD,
+  NUM_ZONES,
+  PROFILE_MAX_FRAMES = 36000, // frames sampled per level, 10 minutes
+};
+
+const char *zone_names[NUM_ZONES] = {
+  "game_update",
+  "map_update",
+  "object_update",
+  "collides",
+  "creature_move",
+  "spawn",
+  "game_draw",
+  "map_draw",
+  "hud",
+};
+
+typedef struct Profile {
+  i64 level; // level being sampled
+  u32 frames; // frames run in the level
+  u64 cycles[NUM_ZONES]; // counted in the current frame
+  u64 calls[NUM_ZONES];
+  u64 total_cycles[NUM_ZONES]; // counted in the level
+  u64 total_calls[NUM_ZONES];
+  u32 samples[NUM_ZONES][PROFILE_MAX_FRAMES]; // cycles of each frame in the level
+} Profile;
+
+typedef struct ProfileScope {
+  Profile *profile;
+  u8 zone;
+  u64 start;
+} ProfileScope;
+
+u64 profile_cycles() {
+#if defined(__riscv)
+  u64 cycles;
+  __asm__ __volatile__ ("rdcycle %0" : "=r"(cycles));
+  return cycles;
+#elif defined(__x86_64__) || defined(__i386__)
+  u32 lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+  return (u64)hi << 32 | lo;
+#else
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec*1000000000ull + ts.tv_nsec;
+#endif
+}
+
+ProfileScope profile_zone_begin(Profile *profile, u8 zone) {
+  return (ProfileScope){profile, zone, profile_cycles()};
+}
+
+void profile_zone_end(ProfileScope *scope) {
+  scope->profile->cycles[scope->zone] += profile_cycles() - scope->start;
+  scope->profile->calls[scope->zone]++;
+}
+
+int compare_samples(const void *a, const void *b) {
+  u32 x = *(const u32*)a, y = *(const u32*)b;
+  return (x > y) - (x < y);
+}
+
+// prints cycles per frame of each zone in the sampled level, sorts its samples
+void profile_report(Profile *profile) {
+  if (profile->frames == 0) {
+    return;
+  }
+  u32 count = mini(profile->frames, PROFILE_MAX_FRAMES);
+  riv_printf("PROFILE LEVEL %ld, %u frames, cycles per frame\n", profile->level, profile->frames);
+  riv_printf("%-14s %10s %10s %10s %10s\n", "zone", "calls", "min", "avg", "p99");
+  for (u32 zone=0;zone<NUM_ZONES;++zone) {
+    u32 *samples = profile->samples[zone];
+    qsort(samples, count, sizeof(u32), compare_samples);
+    riv_printf("%-14s %10.1f %10u %10lu %10u\n", zone_names[zone],
+      (f64)profile->total_calls[zone] / profile->frames, samples[0],
+      profile->total_cycles[zone] / profile->frames, samples[(count-1)*99/100]);
+  }
+}
+
+// keeps the totals of the frame that just ended
+void profile_frame_end(Profile *profile, i64 level) {
+  if (level != profile->level) {
+    profile_report(profile);
+    memset(profile, 0, offsetof(Profile, samples));
+    profile->level = level;
+  }
+  for (u32 zone=0;zone<NUM_ZONES;++zone) {
+    if (profile->frames < PROFILE_MAX_FRAMES) {
+      profile->samples[zone][profile->frames] = mini(profile->cycles[zone], UINT32_MAX);
+    }
+    profile->total_cycles[zone] += profile->cycles[zone];
+    profile->total_calls[zone] += profile->calls[zone];
+    profile->cycles[zone] = 0;
+    profile->calls[zone] = 0;
+  }
+  profile->frames++;
+}
+
+// counts the cycles until the end of the enclosing block in a zone
+#define PROFILE_ZONE(zone) ProfileScope profile_scope __attribute__((cleanup(profile_zone_end))) = profile_zone_begin(&game->profile, zone)
+
+#else
+
+#define PROFILE_ZONE(zone)
+
+#endif
 
 //------------------------------------------------------------------------------
 // Game state
 
-Object objects[MAX_OBJECTS];
-u32 object_count;
-Player* main_player;
-i64 picked_keys;
-i64 level;
-Object *first_collidable;
-i64 next_level;
-u64 shake_frame;
-u64 end_frame;
-i64 kills;
-i64 coins;
+// Everything a running game mutates, so several games can be simulated side by side,
+// the gfx_objects prototypes are shared by all games and read-only once loaded.
+typedef struct GameState {
+  Object objects[MAX_OBJECTS];
+  u32 object_count;
+  u16 free_ids[MAX_OBJECTS]; // slots of removed objects ready for reuse
+  u32 free_count;
+  u32 spawn_count;
+  Player* main_player; // resolved from main_player_handle
+  Handle main_player_handle;
+  i64 picked_keys;
+  i64 level;
+  u32 first_collidable; // spawn sequence of the last object ignored by collisions
+  i64 next_level;
+  u64 shake_frame;
+  vec2i shake_offset; // screen shake rolled for the current frame
+  u64 end_frame;
+  i64 kills;
+  i64 coins;
+  u8 tiles[NUM_MAP_LAYERS][MAP_SIZE][MAP_SIZE]; // static cells drawn as a tilemap, only ground and walls
+  u16 pools[NUM_POOLS][MAX_OBJECTS]; // object ids of each pool, in spawn order
+  u32 pool_counts[NUM_POOLS];
+  u16 awake[MAX_OBJECTS]; // object ids of actors to update, in spawn order
+  u16 draw_ids[MAX_OBJECTS]; // object ids to draw in the current frame, layer by layer
+  u16 draw_sort_ids[MAX_OBJECTS]; // scratch for sorting draw_ids
+  u32 draw_starts[NUM_DRAW_LAYERS+1]; // first draw_ids index of each layer
+  u32 awake_count;
+  u16 sleep_cells[MAP_SIZE*MAP_SIZE]; // first sleeping object id of each cell
+  u8 chunk_pixels[NUM_CHUNK_LAYERS][NUM_CHUNKS][NUM_CHUNKS][CHUNK_PIXELS*CHUNK_PIXELS]; // pre-composited static tiles
+  u64 chunk_opaque[NUM_CHUNKS][NUM_CHUNKS][CHUNK_PIXELS][CHUNK_MASK_WORDS]; // pixels covered by wall chunks
+  bool chunk_dirty[NUM_CHUNK_LAYERS][NUM_CHUNKS][NUM_CHUNKS]; // chunks that must be composited again
+  u8 hud_pixels[SCREEN_PIXELS*SCREEN_PIXELS]; // pre-composited HUD
+  u64 hud_opaque[SCREEN_PIXELS][SCREEN_PIXELS/64]; // pixels covered by the HUD
+  recti hud_rect; // bounds of the covered pixels
+  HudKey hud_key; // values shown by the pre-composited HUD
+  bool hud_valid;
+  u16 grid_cells[MAP_SIZE*MAP_SIZE]; // first object id of each spatial index cell
+  i64 grid_max_size; // largest bbox dimension of indexed objects
+  u64 wall_mask[MAP_PIXELS][WALL_MASK_WORDS]; // solid pixels of static walls
+  u64 wall_inner_mask[MAP_PIXELS][WALL_MASK_WORDS]; // points strictly inside static walls
+  u16 compact_ids[MAX_OBJECTS]; // new slot of each object, 0 for freed slots
+  u64 state_hash; // sum of the digests of all objects
+  u16 touched[MAX_OBJECTS]; // object ids changed in the current frame
+  u32 touched_count;
+#ifdef PROFILE
+  Profile profile;
+#endif
+} GameState;
+
+GameState main_game;
+_Thread_local GameState *game = &main_game; // game simulated by the current thread
 
 //------------------------------------------------------------------------------
 // Game utils
 
 Object *spawn(u16 gfx, u16 l, f64 x, f64 y);
+void object_free(Object *object);
+void object_touch(Object *object);
+void tile_set(u16 gfx, u8 layer, i64 x, i64 y);
 
 void sfx(u16 sfx) {
+#ifdef HEADLESS
+  (void)sfx;
+#else
   for (u64 i=0;i<NUM_SFX_CHANNELS && sfx_descs[sfx][i].type != RIV_WAVEFORM_NONE;++i) {
     riv_waveform(&sfx_descs[sfx][i]);
   }
+#endif
 }
 
 i64 timer_countdown(u64 start_frame, u64 duration) {
@@ -217,8 +465,8 @@ i64 timer_countdown(u64 start_frame, u64 duration) {
 }
 
 Object *find_object_by_spr(u16 spr) {
-  for (u32 i=1;i<=object_count;++i) {
-    Object *object = &objects[i];
+  for (u32 i=1;i<=game->object_count;++i) {
+    Object *object = &game->objects[i];
     if (object->thing.spr == spr) {
       return object;
     }
@@ -228,12 +476,216 @@ Object *find_object_by_spr(u16 spr) {
 
 void end_game() {
   // game completed
-  next_level = NUM_LEVELS;
+  game->next_level = num_levels;
   sfx(SFX_GAME_COMPLETE1);
   sfx(SFX_GAME_COMPLETE2);
   sfx(SFX_GAME_COMPLETE3);
   riv->quit_frame = riv->frame + 240; // quit in 4 seconds
-  end_frame = riv->frame;
+  game->end_frame = riv->frame;
+}
+
+//------------------------------------------------------------------------------
+// Spatial index
+
+// Only things that can block or be hit are indexed, each one is linked to the
+// cell containing its bbox top left corner, queries expand by the largest bbox.
+// Static walls are not indexed, they live in the wall mask instead.
+
+bool thing_is_static_wall(Thing *thing) {
+  return thing->type == TYPE_WALL && !thing->phantom && !thing->dynamic &&
+         thing->bbox.width > 0 && thing->bbox.height > 0;
+}
+
+bool grid_indexable(Thing *thing) {
+  return (thing->type & (TYPE_WALL | TYPE_CREATURE)) != 0 && !thing->phantom && !thing_is_static_wall(thing);
+}
+
+i64 grid_cell_coord(i64 px) {
+  return clampi(px / TILE_PIXELS, 0, MAP_SIZE-1);
+}
+
+u16 grid_cell_at(recti bbox) {
+  return grid_cell_coord(bbox.y)*MAP_SIZE + grid_cell_coord(bbox.x);
+}
+
+void grid_clear() {
+  for (u32 i=1;i<=game->object_count;++i) {
+    game->objects[i].thing.indexed = false;
+  }
+  memset(game->grid_cells, 0, sizeof(game->grid_cells));
+  game->grid_max_size = 0;
+}
+
+void grid_unlink(Thing *thing) {
+  if (!thing->indexed) {
+    return;
+  }
+  if (thing->cell_prev) {
+    game->objects[thing->cell_prev].thing.cell_next = thing->cell_next;
+  } else {
+    game->grid_cells[thing->cell] = thing->cell_next;
+  }
+  if (thing->cell_next) {
+    game->objects[thing->cell_next].thing.cell_prev = thing->cell_prev;
+  }
+  thing->indexed = false;
+  thing->cell_prev = 0;
+  thing->cell_next = 0;
+}
+
+void grid_link(Thing *thing) {
+  if (!grid_indexable(thing)) {
+    return;
+  }
+  thing->cell = grid_cell_at(thing->bbox);
+  thing->cell_prev = 0;
+  thing->cell_next = game->grid_cells[thing->cell];
+  if (thing->cell_next) {
+    game->objects[thing->cell_next].thing.cell_prev = thing->id;
+  }
+  game->grid_cells[thing->cell] = thing->id;
+  thing->indexed = true;
+  game->grid_max_size = maxi(game->grid_max_size, maxi(thing->bbox.width, thing->bbox.height));
+}
+
+// must be called whenever a thing bbox changes
+void grid_update(Thing *thing) {
+  if (thing->indexed && thing->cell == grid_cell_at(thing->bbox)) {
+    return;
+  }
+  grid_unlink(thing);
+  grid_link(thing);
+}
+
+//------------------------------------------------------------------------------
+// Wall mask
+
+// One bit per map pixel, packed in 64-bit row words, set where a static wall is.
+// Static walls are never removed, so the mask is only patched when one spawns.
+// Empty bboxes (zero sprite scale) overlap only when strictly inside a wall,
+// so those are tested against a second mask with the walls inner points.
+
+u64 wall_mask_word_bits(i64 word, i64 x0, i64 x1) {
+  i64 lo = maxi(x0 - word*64, 0);
+  i64 hi = mini(x1 - word*64, 64);
+  return hi - lo == 64 ? ~(u64)0 : (((u64)1 << (hi - lo)) - 1) << lo;
+}
+
+void wall_mask_clear() {
+  memset(game->wall_mask, 0, sizeof(game->wall_mask));
+  memset(game->wall_inner_mask, 0, sizeof(game->wall_inner_mask));
+}
+
+void mask_fill(u64 mask[MAP_PIXELS][WALL_MASK_WORDS], recti bbox) {
+  i64 x0 = maxi(bbox.x, 0), x1 = mini(bbox.x + bbox.width, MAP_PIXELS);
+  i64 y0 = maxi(bbox.y, 0), y1 = mini(bbox.y + bbox.height, MAP_PIXELS);
+  for (i64 y=y0;y<y1;++y) {
+    for (i64 w=x0/64;w<=(x1-1)/64;++w) {
+      mask[y][w] |= wall_mask_word_bits(w, x0, x1);
+    }
+  }
+}
+
+bool mask_overlaps(u64 mask[MAP_PIXELS][WALL_MASK_WORDS], recti bbox) {
+  i64 x0 = maxi(bbox.x, 0), x1 = mini(bbox.x + bbox.width, MAP_PIXELS);
+  i64 y0 = maxi(bbox.y, 0), y1 = mini(bbox.y + bbox.height, MAP_PIXELS);
+  if (x0 >= x1) {
+    return false;
+  }
+  i64 w0 = x0/64, w1 = (x1-1)/64;
+  u64 bits0 = wall_mask_word_bits(w0, x0, x1);
+  u64 bits1 = wall_mask_word_bits(w1, x0, x1);
+  for (i64 y=y0;y<y1;++y) {
+    if ((mask[y][w0] & bits0) || (mask[y][w1] & bits1)) {
+      return true;
+    }
+    for (i64 w=w0+1;w<w1;++w) {
+      if (mask[y][w]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void wall_mask_fill(recti bbox) {
+  mask_fill(game->wall_mask, bbox);
+  mask_fill(game->wall_inner_mask, (recti){bbox.x + 1, bbox.y + 1, bbox.width - 1, bbox.height - 1});
+}
+
+bool wall_mask_overlaps(recti bbox) {
+  if (bbox.width == 0 && bbox.height == 0) {
+    return mask_overlaps(game->wall_inner_mask, (recti){bbox.x, bbox.y, 1, 1});
+  }
+  return mask_overlaps(game->wall_mask, bbox);
+}
+
+bool mask_row_overlaps(u64 mask[MAP_PIXELS][WALL_MASK_WORDS], i64 y, i64 x0, i64 x1) {
+  for (i64 w=x0/64;w<=(x1-1)/64;++w) {
+    if (mask[y][w] & wall_mask_word_bits(w, x0, x1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the first coordinate along an axis in [from, limit) that is solid for
+// any coordinate in [o0, o1) of the other axis, or -1 when there is none.
+i64 mask_first_along(u64 mask[MAP_PIXELS][WALL_MASK_WORDS], i64 axis, i64 o0, i64 o1, i64 from, i64 limit) {
+  o0 = maxi(o0, 0); o1 = mini(o1, MAP_PIXELS);
+  from = maxi(from, 0); limit = mini(limit, MAP_PIXELS);
+  if (o0 >= o1) {
+    return -1;
+  }
+  if (axis == 1) { // scan rows
+    for (i64 y=from;y<limit;++y) {
+      if (mask_row_overlaps(mask, y, o0, o1)) {
+        return y;
+      }
+    }
+    return -1;
+  }
+  i64 found = -1;
+  for (i64 y=o0;y<o1;++y) { // scan columns of each row
+    for (i64 w=from/64;w*64<limit;++w) {
+      u64 bits = mask[y][w] & wall_mask_word_bits(w, from, limit);
+      if (bits) {
+        found = w*64 + __builtin_ctzll(bits);
+        limit = found;
+        break;
+      }
+    }
+  }
+  return found;
+}
+
+// Same as above, but returns the last solid coordinate in [limit, from).
+i64 mask_last_along(u64 mask[MAP_PIXELS][WALL_MASK_WORDS], i64 axis, i64 o0, i64 o1, i64 limit, i64 from) {
+  o0 = maxi(o0, 0); o1 = mini(o1, MAP_PIXELS);
+  limit = maxi(limit, 0); from = mini(from, MAP_PIXELS);
+  if (o0 >= o1) {
+    return -1;
+  }
+  if (axis == 1) { // scan rows
+    for (i64 y=from-1;y>=limit;--y) {
+      if (mask_row_overlaps(mask, y, o0, o1)) {
+        return y;
+      }
+    }
+    return -1;
+  }
+  i64 found = -1;
+  for (i64 y=o0;y<o1;++y) { // scan columns of each row
+    for (i64 w=(from-1)/64;w>=0 && (w+1)*64>limit;--w) {
+      u64 bits = mask[y][w] & wall_mask_word_bits(w, limit, from);
+      if (bits) {
+        found = w*64 + 63 - __builtin_clzll(bits);
+        limit = found + 1;
+        break;
+      }
+    }
+  }
+  return found;
 }
 
 //------------------------------------------------------------------------------
@@ -263,27 +715,44 @@ recti thing_bbox_at(Thing* thing, vec2 pos) {
   return bbox;
 }
 
+// animation step at the current frame, fills the prototype table on load
+u32 thing_get_anim_step(Thing* thing) {
+  i64 frame = (riv->frame - thing->spawn_frame) / thing->spr_frame_duration;
+  return frame % (thing->spr_frames + thing->spr_loop_delay);
+}
+
+// (re)starts the animation from its first step, after spawn_frame or spr_frame_duration changed
+void thing_anim_restart(Thing* thing) {
+  thing->anim_step = 0;
+  thing->anim_step_end = thing->spawn_frame + thing->spr_frame_duration;
+}
+
+// advances one step at a time while drawn every frame, catches up at once otherwise
+void thing_anim_advance(Thing* thing) {
+  if (riv->frame < thing->anim_step_end) {
+    return;
+  }
+  if (riv->frame - thing->anim_step_end >= thing->spr_frame_duration) {
+    thing->anim_step = thing_get_anim_step(thing);
+    thing->anim_step_end = riv->frame + thing->spr_frame_duration - (riv->frame - thing->spawn_frame) % thing->spr_frame_duration;
+  } else {
+    thing->anim_step = thing->anim_step + 1 == thing->spr_frames + thing->spr_loop_delay ? 0 : thing->anim_step + 1;
+    thing->anim_step_end += thing->spr_frame_duration;
+  }
+}
+
 u32 thing_get_spr_anim(Thing* thing, u32 spr) {
   if (spr == 0) {
     spr = thing->spr;
   }
   if (thing->spr_frame_duration > 0) {
-    i64 frame = (riv->frame - thing->spawn_frame) / thing->spr_frame_duration;
-    if (thing->spr_loop_delay > 0) {
-      frame = maxi(frame % (thing->spr_frames + thing->spr_loop_delay) - thing->spr_loop_delay, 0);
-    }
-    u32 anim_spr = spr + (frame % thing->spr_frames) * thing->spr_tiles.x;
-    if (thing->spr_tiles.y > 1) {
-      spr = anim_spr + ((anim_spr / SPRITESHEET_COLUMNS) - (spr / SPRITESHEET_COLUMNS)) *
-                       (thing->spr_tiles.y - 1) * SPRITESHEET_COLUMNS;
-    } else {
-      spr = anim_spr;
-    }
+    thing_anim_advance(thing);
+    spr += gfx_anims[thing->anim][thing->anim_step];
   }
   return spr;
 }
 
-void thing_draw(Thing* thing, u32 spr, i64 ox, i64 oy) {
+void thing_draw(Thing* thing, u32 spr, u64 sps, i64 ox, i64 oy) {
   if (thing->spr == 0) {
     return;
   }
@@ -295,7 +764,7 @@ void thing_draw(Thing* thing, u32 spr, i64 ox, i64 oy) {
   // draw sprite
   spr = thing_get_spr_anim(thing, spr);
   vec2i pos = ifloor_vec2(thing->pos);
-  riv_draw_sprite(spr, SPRITESHEET_GAME, pos.x + ox, pos.y + oy, thing->spr_tiles.x, thing->spr_tiles.y, thing->spr_scale.x, thing->spr_scale.y);
+  riv_draw_sprite(spr, sps, pos.x + ox, pos.y + oy, thing->spr_tiles.x, thing->spr_tiles.y, thing->spr_scale.x, thing->spr_scale.y);
   // restore blending
   if (opaque) {
     riv->draw.color_key_disabled = false;
@@ -313,59 +782,213 @@ void thing_draw(Thing* thing, u32 spr, i64 ox, i64 oy) {
 #endif
 }
 
+// returns the colliding object spawned first after last, so it can be iterated in spawn order
 Object* thing_collides_with(Thing* thing, recti bbox, u8 type, Object* last) {
-  for (u32 i=last ? last->thing.id+1 : 1;i<=object_count;++i) {
-    Object *other = &objects[i];
-    if ((other->thing.type & type) != 0 &&
-        overlaps_recti(bbox, other->thing.bbox) &&
-        &other->thing != thing && !other->thing.removed && !other->thing.phantom) {
-      return other;
+  PROFILE_ZONE(ZONE_COLLIDES);
+  u32 after = last ? last->thing.seq : game->first_collidable;
+  Object *found = NULL;
+  i64 x0 = grid_cell_coord(bbox.x - game->grid_max_size + 1), x1 = grid_cell_coord(bbox.x + bbox.width - 1);
+  i64 y0 = grid_cell_coord(bbox.y - game->grid_max_size + 1), y1 = grid_cell_coord(bbox.y + bbox.height - 1);
+  for (i64 cy=y0;cy<=y1;++cy) {
+    for (i64 cx=x0;cx<=x1;++cx) {
+      for (u16 i=game->grid_cells[cy*MAP_SIZE + cx];i!=0;i=game->objects[i].thing.cell_next) {
+        Object *other = &game->objects[i];
+        if (other->thing.seq > after && (!found || other->thing.seq < found->thing.seq) &&
+            (other->thing.type & type) != 0 &&
+            overlaps_recti(bbox, other->thing.bbox) &&
+            &other->thing != thing && !other->thing.removed && !other->thing.phantom) {
+          found = other;
+        }
+      }
     }
   }
-  return NULL;
+  return found;
+}
+
+// collects all colliding objects after last (unordered), returns how many were found
+u32 thing_collides_all(Thing* thing, recti bbox, u8 type, Object* last, Object **found, u32 max_found) {
+  PROFILE_ZONE(ZONE_COLLIDES);
+  u32 after = last ? last->thing.seq : game->first_collidable;
+  u32 count = 0;
+  i64 x0 = grid_cell_coord(bbox.x - game->grid_max_size + 1), x1 = grid_cell_coord(bbox.x + bbox.width - 1);
+  i64 y0 = grid_cell_coord(bbox.y - game->grid_max_size + 1), y1 = grid_cell_coord(bbox.y + bbox.height - 1);
+  for (i64 cy=y0;cy<=y1;++cy) {
+    for (i64 cx=x0;cx<=x1;++cx) {
+      for (u16 i=game->grid_cells[cy*MAP_SIZE + cx];i!=0;i=game->objects[i].thing.cell_next) {
+        Object *other = &game->objects[i];
+        if (other->thing.seq > after && (other->thing.type & type) != 0 &&
+            overlaps_recti(bbox, other->thing.bbox) &&
+            &other->thing != thing && !other->thing.removed && !other->thing.phantom) {
+          if (count < max_found) {
+            found[count] = other;
+          }
+          count++;
+        }
+      }
+    }
+  }
+  return count;
 }
 
 bool thing_collides_at(Thing* thing, vec2 pos) {
-  return thing_collides_with(thing, thing_bbox_at(thing, pos), TYPE_WALL | TYPE_CREATURE, first_collidable) != NULL;
+  recti bbox = thing_bbox_at(thing, pos);
+  return wall_mask_overlaps(bbox) ||
+         thing_collides_with(thing, bbox, TYPE_WALL | TYPE_CREATURE, NULL) != NULL;
 }
 
 bool thing_collides_with_player(Thing* thing) {
-  return !main_player->thing.removed && overlaps_recti(thing->bbox, main_player->thing.bbox);
+  return !game->main_player->thing.removed && overlaps_recti(thing->bbox, game->main_player->thing.bbox);
 }
 
 //------------------------------------------------------------------------------
 // Creature
 
-void creature_move(Creature* creature, vec2 delta) {
-  if (delta.x != 0) { // move x
-    f64 val = abst(delta.x);
-    f64 sgn = sign(delta.x);
-    vec2 start_pos = creature->thing.pos;
-    vec2 pos = start_pos;
-    // move pixel by pixel until it collides
-    for (i64 d = 0; d <= iceil(val); ++d) {
-      pos.x = start_pos.x+min(d, val)*sgn;
-      if (thing_collides_at(&creature->thing, pos)) {
-        break;
+enum {
+  MAX_MOVE_BLOCKERS = 64,
+};
+
+recti creature_step_bbox(Creature* creature, vec2 start_pos, i64 axis, f64 val, f64 sgn, i64 d) {
+  vec2 pos = start_pos;
+  if (axis == 0) {
+    pos.x = start_pos.x+min(d, val)*sgn;
+  } else {
+    pos.y = start_pos.y+min(d, val)*sgn;
+  }
+  return thing_bbox_at(&creature->thing, pos);
+}
+
+// first step before end with the bbox low coordinate beyond the threshold, or end when none
+i64 creature_step_beyond(Creature* creature, vec2 start_pos, i64 axis, f64 val, f64 sgn, i64 end, i64 threshold) {
+  for (i64 d = 0; d < end; ++d) {
+    recti bbox = creature_step_bbox(creature, start_pos, axis, val, sgn, d);
+    i64 lo = axis == 0 ? bbox.x : bbox.y;
+    if (sgn > 0 ? lo > threshold : lo < threshold) {
+      return d;
+    }
+  }
+  return end;
+}
+
+// Moves along one axis with the same result of moving pixel by pixel until it
+// collides, but the blocking step is computed from each blocker position.
+void creature_move_axis(Creature* creature, i64 axis, f64 delta, Object **blockers, u32 blocker_count) {
+  f64 val = abst(delta);
+  f64 sgn = sign(delta);
+  i64 steps = iceil(val);
+  vec2 start_pos = creature->thing.pos;
+  recti start_bbox = thing_bbox_at(&creature->thing, start_pos);
+  recti end_bbox = creature_step_bbox(creature, start_pos, axis, val, sgn, steps);
+  i64 lo = axis == 0 ? start_bbox.x : start_bbox.y;
+  i64 end_lo = axis == 0 ? end_bbox.x : end_bbox.y;
+  i64 size = axis == 0 ? start_bbox.width : start_bbox.height;
+  i64 blocked = steps + 1; // first colliding step
+  // dynamic blockers, the bbox range along the other axis never changes
+  for (u32 i=0;i<blocker_count;++i) {
+    recti other = blockers[i]->thing.bbox;
+    if (axis == 0 ? !(start_bbox.y + start_bbox.height > other.y && other.y + other.height > start_bbox.y) :
+                    !(start_bbox.x + start_bbox.width > other.x && other.x + other.width > start_bbox.x)) {
+      continue;
+    }
+    i64 other_lo = axis == 0 ? other.x : other.y;
+    i64 other_size = axis == 0 ? other.width : other.height;
+    i64 threshold = sgn > 0 ? other_lo - size : other_lo + other_size;
+    i64 d = creature_step_beyond(creature, start_pos, axis, val, sgn, blocked, threshold);
+    if (d < blocked) {
+      recti bbox = creature_step_bbox(creature, start_pos, axis, val, sgn, d);
+      i64 d_lo = axis == 0 ? bbox.x : bbox.y;
+      if (sgn > 0 ? other_lo + other_size > d_lo : d_lo + size > other_lo) {
+        blocked = d;
       }
-      creature->thing.pos.x = pos.x;
-      creature->thing.bbox = thing_bbox_at(&creature->thing, pos);
     }
   }
-  if (delta.y != 0) { // move y
-    f64 val = abst(delta.y);
-    f64 sgn = sign(delta.y);
-    vec2 start_pos = creature->thing.pos;
-    vec2 pos = start_pos;
-    // move pixel by pixel until it collides
-    for (i64 d = 0; d <= iceil(val); ++d) {
-      pos.y = start_pos.y+min(d, val)*sgn;
-      if (thing_collides_at(&creature->thing, pos)) {
-        break;
+  // static walls, empty bboxes are tested as a single inner point
+  u64 (*mask)[WALL_MASK_WORDS] = game->wall_mask;
+  i64 o0 = axis == 0 ? start_bbox.y : start_bbox.x;
+  i64 o1 = o0 + (axis == 0 ? start_bbox.height : start_bbox.width);
+  i64 wsize = size;
+  if (start_bbox.width == 0 && start_bbox.height == 0) {
+    mask = game->wall_inner_mask;
+    o1 = o0 + 1;
+    wsize = 1;
+  }
+  i64 from = sgn > 0 ? lo : lo + wsize;
+  while (blocked > 0) {
+    i64 p = sgn > 0 ? mask_first_along(mask, axis, o0, o1, from, end_lo + wsize) :
+                      mask_last_along(mask, axis, o0, o1, end_lo, from);
+    if (p < 0) {
+      break;
+    }
+    i64 d = creature_step_beyond(creature, start_pos, axis, val, sgn, blocked, sgn > 0 ? p - wsize : p + 1);
+    if (d >= blocked) {
+      break;
+    }
+    recti bbox = creature_step_bbox(creature, start_pos, axis, val, sgn, d);
+    i64 d_lo = axis == 0 ? bbox.x : bbox.y;
+    if (sgn > 0 ? d_lo <= p : d_lo + wsize > p) {
+      blocked = d;
+      break;
+    }
+    from = sgn > 0 ? d_lo : d_lo + wsize; // skipped over it, continue from there
+  }
+  // rest at the last free step
+  if (blocked > 0) {
+    i64 d = blocked - 1;
+    if (axis == 0) {
+      creature->thing.pos.x = start_pos.x+min(d, val)*sgn;
+    } else {
+      creature->thing.pos.y = start_pos.y+min(d, val)*sgn;
+    }
+    creature->thing.bbox = thing_bbox_at(&creature->thing, creature->thing.pos);
+    grid_update(&creature->thing);
+  }
+}
+
+void creature_move(Creature* creature, vec2 delta) {
+  PROFILE_ZONE(ZONE_CREATURE_MOVE);
+  if (delta.x == 0 && delta.y == 0) {
+    return;
+  }
+  // gather blockers once over the whole swept region
+  recti bbox = thing_bbox_at(&creature->thing, creature->thing.pos);
+  vec2 end_pos = add_vec2(creature->thing.pos, delta);
+  recti end_bbox = thing_bbox_at(&creature->thing, end_pos);
+  i64 x0 = mini(bbox.x, end_bbox.x) - 1, y0 = mini(bbox.y, end_bbox.y) - 1;
+  i64 x1 = maxi(bbox.x, end_bbox.x) + bbox.width + 1, y1 = maxi(bbox.y, end_bbox.y) + bbox.height + 1;
+  recti swept_bbox = {x0, y0, x1 - x0, y1 - y0};
+  Object *blockers[MAX_MOVE_BLOCKERS];
+  u32 blocker_count = thing_collides_all(&creature->thing, swept_bbox, TYPE_WALL | TYPE_CREATURE, NULL,
+                                         blockers, MAX_MOVE_BLOCKERS);
+  if (blocker_count > MAX_MOVE_BLOCKERS) { // too crowded, step pixel by pixel
+    for (i64 axis = 0; axis < 2; ++axis) {
+      f64 axis_delta = axis == 0 ? delta.x : delta.y;
+      if (axis_delta == 0) {
+        continue;
+      }
+      f64 val = abst(axis_delta);
+      f64 sgn = sign(axis_delta);
+      vec2 start_pos = creature->thing.pos;
+      vec2 pos = start_pos;
+      for (i64 d = 0; d <= iceil(val); ++d) {
+        if (axis == 0) {
+          pos.x = start_pos.x+min(d, val)*sgn;
+        } else {
+          pos.y = start_pos.y+min(d, val)*sgn;
+        }
+        if (thing_collides_at(&creature->thing, pos)) {
+          break;
+        }
+        creature->thing.pos = pos;
+        creature->thing.bbox = thing_bbox_at(&creature->thing, pos);
+        grid_update(&creature->thing);
       }
-      creature->thing.pos.y = pos.y;
-      creature->thing.bbox = thing_bbox_at(&creature->thing, pos);
     }
+    return;
+  }
+  if (delta.x != 0) { // move x
+    creature_move_axis(creature, 0, delta.x, blockers, blocker_count);
+  }
+  if (delta.y != 0) { // move y
+    creature_move_axis(creature, 1, delta.y, blockers, blocker_count);
   }
 }
 
@@ -373,17 +996,18 @@ void creature_hit(Creature *creature, i64 damage) {
   if (creature->health == 0) {
     return;
   }
+  object_touch(&game->objects[creature->thing.id]);
   creature->health = maxi(creature->health - damage, 0);
   creature->hurt_frame = riv->frame;
-  sfx(creature == &main_player->creature ? SFX_HURT_PLAYER : SFX_HURT_MONSTER);
+  sfx(creature == &game->main_player->creature ? SFX_HURT_PLAYER : SFX_HURT_MONSTER);
   if (creature->health == 0) { // died
     spawn(GFX_EFFECT_DUST, MAP_LAYER_EFFECTS, creature->thing.pos.x, creature->thing.pos.y);
     creature->die_frame = riv->frame + 8;
-    if (creature == &main_player->creature) {
+    if (creature == &game->main_player->creature) {
       sfx(SFX_DIE_PLAYER);
       riv->quit_frame = riv->frame + 180; // quit in 3 seconds
     } else {
-      kills++;
+      game->kills++;
       sfx(SFX_DIE_MONSTER);
     }
   }
@@ -400,7 +1024,7 @@ void creature_pull_hit(Creature *creature, i64 xdir, i64 damage) {
   creature->slowdown_until_frame = riv->frame + 30;
 }
 
-void creature_draw(Creature* creature, u32 spr, i64 ox, i64 oy) {
+void creature_draw(Creature* creature, u32 spr, u64 sps, i64 ox, i64 oy) {
   if (spr == 0) {
     spr = creature->thing.spr;
   }
@@ -409,13 +1033,9 @@ void creature_draw(Creature* creature, u32 spr, i64 ox, i64 oy) {
   }
   i64 hurt_ticks = riv->frame - creature->hurt_frame;
   if (hurt_ticks < 12 && creature->hurt_frame > 0) {
-    riv->draw.pal_enabled = true;
-    riv->draw.pal[0] = RIV_COLOR_RED; // red
-    thing_draw(&creature->thing, spr, ox, oy-hurt_ticks/6);
-    riv->draw.pal[0] = 0;
-    riv->draw.pal_enabled = false;
+    thing_draw(&creature->thing, spr, sps + SPRITESHEET_GAME_HURT - SPRITESHEET_GAME, ox, oy-hurt_ticks/6);
   } else {
-    thing_draw(&creature->thing, spr, ox, oy);
+    thing_draw(&creature->thing, spr, sps, ox, oy);
   }
 }
 
@@ -428,7 +1048,7 @@ void creature_update(Creature *creature) {
 //------------------------------------------------------------------------------
 // Monster
 
-void monster_draw(Monster *monster) {
+void monster_draw(Monster *monster, u64 sps) {
   i64 ox = 0;
 
   // push towards attack direction
@@ -439,31 +1059,45 @@ void monster_draw(Monster *monster) {
     }
   }
 
-  creature_draw(&monster->creature, 0, ox, 0);
+  creature_draw(&monster->creature, 0, sps, ox, 0);
 }
 
 void monster_update(Monster *monster) {
   creature_update(&monster->creature);
 
-  vec2 delta = sub_vec2(main_player->thing.pos, monster->thing.pos);
+  vec2 delta = sub_vec2(game->main_player->thing.pos, monster->thing.pos);
+#ifdef FIXED_MATH
+  fx dx = fx_from(delta.x), dy = fx_from(delta.y);
+  f64 dist_sqr = fx_to(fx_mul(dx, dx) + fx_mul(dy, dy));
+#else
   vec2 delta_sqr = sqr_vec2(delta);
   f64 dist_sqr = delta_sqr.x + delta_sqr.y;
+#endif
 
   // attack if player is very near
   if (dist_sqr <= sqr(TILE_PIXELS) && riv->frame >= monster->creature.attack1_frame + monster->creature.attack1_delay &&
       riv->frame != monster->thing.spawn_frame) {
     monster->creature.attack1_frame = riv->frame;
-    creature_hit(&main_player->creature, monster->creature.attack1_damage);
+    creature_hit(&game->main_player->creature, monster->creature.attack1_damage);
   }
 
   if (dist_sqr <= sqr(TILE_PIXELS*monster->sight)) { // player is near
     if (dist_sqr >= 1) {
       // move towards player
+#ifdef FIXED_MATH
+      fx speed = fx_from(monster->creature.speed);
+      if (monster->creature.slowdown_until_frame > riv->frame) {
+        speed = fx_mul(speed, fx_from(monster->creature.slowdown));
+      }
+      fx dist = isqrt(dx*dx + dy*dy);
+      vec2 move_delta = {fx_to(dx*speed/dist), fx_to(dy*speed/dist)};
+#else
       f64 speed = monster->creature.speed;
       if (monster->creature.slowdown_until_frame > riv->frame) {
         speed *= monster->creature.slowdown;
       }
       vec2 move_delta = mul_vec2_scalar(delta, speed/sqrt(dist_sqr));
+#endif
       creature_move(&monster->creature, move_delta);
       // turn towards player
       monster->thing.spr_scale.x = isign(move_delta.x) * absi(monster->thing.spr_scale.x);
@@ -471,11 +1105,17 @@ void monster_update(Monster *monster) {
   } else if (dist_sqr <= sqr(TILE_PIXELS*12)) { // player is in sight
     // do random move
     vec2 pos = monster->thing.pos;
+#ifdef FIXED_MATH
+    pos.x += fx_to((fx)riv_rand_uint(2*FX_ONE) - FX_ONE);
+    pos.y += fx_to((fx)riv_rand_uint(2*FX_ONE) - FX_ONE);
+#else
     pos.x += riv_rand_float()*2-1;
     pos.y += riv_rand_float()*2-1;
+#endif
     if (!thing_collides_at(&monster->thing, pos)) {
       monster->thing.pos = pos;
       monster->thing.bbox = thing_bbox_at(&monster->thing, pos);
+      grid_update(&monster->thing);
     }
   } else {
     // out of sight
@@ -506,14 +1146,14 @@ void slime_boss_update(Monster* monster) {
   } else if (riv->frame % 300 == 0) {
     // count monsters
     u64 monsters = 0;
-    for (u32 i=1;i<=object_count;++i) {
-      Object *object = &objects[i];
+    for (u32 i=0;i<game->pool_counts[POOL_ACTORS];++i) {
+      Object *object = &game->objects[game->pools[POOL_ACTORS][i]];
       if (!object->thing.removed && object->thing.type == TYPE_MONSTER) {
         monsters++;
       }
     }
     // spawn minions
-    if (monsters == 1 && !main_player->thing.removed) {
+    if (monsters == 1 && !game->main_player->thing.removed) {
       slime_boss_spawn_minion(monster,-1, 0);
       slime_boss_spawn_minion(monster, 1, 0);
       slime_boss_spawn_minion(monster, 0, 1);
@@ -523,17 +1163,7 @@ void slime_boss_update(Monster* monster) {
 }
 
 void slime_boss_draw(Monster* monster) {
-  riv->draw.pal_enabled = true;
-  riv->draw.pal[32] = RIV_COLOR_ORANGE;
-  riv->draw.pal[33] = RIV_COLOR_GOLD;
-  riv->draw.pal[34] = RIV_COLOR_YELLOW;
-  riv->draw.pal[35] = RIV_COLOR_LIGHTYELLOW;
-  monster_draw(monster);
-  riv->draw.pal[32] = 32;
-  riv->draw.pal[33] = 33;
-  riv->draw.pal[34] = 34;
-  riv->draw.pal[35] = 35;
-  riv->draw.pal_enabled = false;
+  monster_draw(monster, SPRITESHEET_GAME_GOLD);
 }
 
 //------------------------------------------------------------------------------
@@ -558,7 +1188,7 @@ void player_attack_sword(Player *player) {
 
     // attack monsters
     recti bbox = expand_recti(effect->thing.bbox, 4);
-    Object *object = first_collidable;
+    Object *object = NULL;
     while ((object = thing_collides_with(&player->thing, bbox, TYPE_MONSTER, object))) {
       creature_pull_hit(&object->creature, player->thing.spr_scale.x, player->creature.attack1_damage);
     }
@@ -575,7 +1205,7 @@ void player_attack_bomb(Player *player) {
 void player_update(Player *player) {
   creature_update(&player->creature);
   if (player->thing.removed) { // died
-    end_frame = riv->frame;
+    game->end_frame = riv->frame;
     return;
   }
 
@@ -607,6 +1237,20 @@ void player_update(Player *player) {
   bool moving = move_horz || move_vert;
   player->creature.moving = moving;
   if (moving) {
+#ifdef FIXED_MATH
+    fx speed = fx_from(player->creature.speed);
+    // increase speed when dashing
+    if (dashing) {
+      i64 dash_progress = maxi(dash_ticks - (player->dash_delay - player->dash_duration), 0);
+      fx boost = fx_from(player->dash_power)*dash_progress/player->dash_duration;
+      speed += fx_mul(speed, fx_mul(boost, boost));
+    }
+    // disallow moving faster in diagonals
+    if (move_horz && move_vert) {
+      speed = fx_mul(speed, 181); // 1/sqrt(2)
+    }
+    f64 step = fx_to(speed);
+#else
     f64 speed = player->creature.speed;
     // increase speed when dashing
     if (dashing) {
@@ -617,12 +1261,14 @@ void player_update(Player *player) {
     if (move_horz && move_vert) {
       speed *= 0.70710678118655; // 1/sqrt(2)
     }
+    f64 step = speed;
+#endif
     vec2 delta = {0,0};
     // horizontal move
     if (move_horz) {
       i64 dir = riv->keys[RIV_GAMEPAD_RIGHT].down ? 1 : -1;
       if (dir == player->thing.spr_scale.x) {
-        delta.x = speed*dir;
+        delta.x = step*dir;
       } else {
         player->thing.spr_scale.x = dir;
       }
@@ -630,14 +1276,14 @@ void player_update(Player *player) {
     // vertical move
     if (move_vert) {
       i64 dir = riv->keys[RIV_GAMEPAD_DOWN].down ? 1 : -1;
-      delta.y = speed*dir;
+      delta.y = step*dir;
     }
     creature_move(&player->creature, delta);
   }
 }
 
 f64 player_get_dist_sqr(Thing* thing) {
-  return distsqr_vec2(main_player->thing.pos, thing->pos);
+  return distsqr_vec2(game->main_player->thing.pos, thing->pos);
 }
 
 //------------------------------------------------------------------------------
@@ -648,14 +1294,14 @@ void spikes_update(Item *item) {
       thing_get_spr_anim(&item->thing, 0) >= GFX_GROUND_SPIKES_HURT &&
       riv->frame >= item->trigger_frame + item->thing.spr_frame_duration * 5) {
     item->trigger_frame = riv->frame;
-    creature_hit(&main_player->creature, item->damage);
+    creature_hit(&game->main_player->creature, item->damage);
   }
 }
 
 void stairs_update(Item *item) {
   if (thing_collides_with_player(&item->thing)) {
-    next_level = level+1;
-    if (next_level == NUM_LEVELS) {
+    game->next_level = game->level+1;
+    if (game->next_level == num_levels) {
       end_game();
     }
   }
@@ -680,11 +1326,11 @@ void bomb_update(Item *item) {
 
       sfx(SFX_EXPLOSION);
 
-      shake_frame = riv->frame + 20;
+      game->shake_frame = riv->frame + 20;
 
       // attack creatures
       recti bbox = expand_recti(effect->thing.bbox, 8);
-      Object *object = first_collidable;
+      Object *object = NULL;
       while ((object = thing_collides_with(&item->thing, bbox, TYPE_MONSTER, object))) {
         creature_pull_hit(&object->creature, isign(object->thing.pos.x - item->thing.pos.x), item->damage);
       }
@@ -693,21 +1339,33 @@ void bomb_update(Item *item) {
   }
 }
 
+// vertical offset of floating upgrades, phase in radians
+f64 upgrade_bob_offset(i64 phase) {
+#ifdef FIXED_MATH
+  // 4 radians per second at 60 fps are 2.716 steps of 1/256 turns per frame
+  return fx_to(-3*FX_ONE + 3*fx_sin(riv->frame*2716/1000 + phase*256000/6283));
+#else
+  return -3+sin(phase+riv->time*4)*3;
+#endif
+}
+
 void upgrade_bomb_update(Item *item) {
   if (thing_collides_with_player(&item->thing)) {
     sfx(SFX_UPGRADE);
-    main_player->creature.attack2_damage = clampi(main_player->creature.attack2_damage+1, 2, 3);
-    main_player->creature.attack2_delay = maxi(main_player->creature.attack2_delay-20, 20);
+    object_touch(&game->objects[game->main_player->thing.id]);
+    game->main_player->creature.attack2_damage = clampi(game->main_player->creature.attack2_damage+1, 2, 3);
+    game->main_player->creature.attack2_delay = maxi(game->main_player->creature.attack2_delay-20, 20);
     item->thing.removed = true;
 
     // find other upgrade and remove it
     Object *other_upgrade = find_object_by_spr(GFX_ITEM_UPGRADE_BLADE);
     if (other_upgrade && distsqr_vec2(other_upgrade->thing.pos, item->thing.pos) <= sqr(TILE_PIXELS*4)) {
       other_upgrade->thing.removed = true;
+      object_touch(other_upgrade);
       spawn(GFX_EFFECT_DUST, MAP_LAYER_EFFECTS, other_upgrade->thing.pos.x, other_upgrade->thing.pos.y);
     }
   } else {
-    item->thing.pos = add_vec2(item->thing.spawn_pos, (vec2){0, -3+sin(riv->time*4)*3});
+    item->thing.pos = add_vec2(item->thing.spawn_pos, (vec2){0, upgrade_bob_offset(0)});
     item->thing.bbox = thing_bbox_at(&item->thing, item->thing.pos);
   }
 }
@@ -715,17 +1373,19 @@ void upgrade_bomb_update(Item *item) {
 void upgrade_blade_update(Item *item) {
   if (thing_collides_with_player(&item->thing)) {
     sfx(SFX_UPGRADE);
-    main_player->creature.attack1_damage += 1;
+    object_touch(&game->objects[game->main_player->thing.id]);
+    game->main_player->creature.attack1_damage += 1;
     item->thing.removed = true;
 
     // find other upgrade and remove it
     Object *other_upgrade = find_object_by_spr(GFX_ITEM_UPGRADE_BOMB);
     if (other_upgrade && distsqr_vec2(other_upgrade->thing.pos, item->thing.pos) <= sqr(TILE_PIXELS*4)) {
       other_upgrade->thing.removed = true;
+      object_touch(other_upgrade);
       spawn(GFX_EFFECT_DUST, MAP_LAYER_EFFECTS, other_upgrade->thing.pos.x, other_upgrade->thing.pos.y);
     }
   } else {
-    item->thing.pos = add_vec2(item->thing.spawn_pos, (vec2){0, -3+sin(3+riv->time*4)*3});
+    item->thing.pos = add_vec2(item->thing.spawn_pos, (vec2){0, upgrade_bob_offset(3)});
     item->thing.bbox = thing_bbox_at(&item->thing, item->thing.pos);
   }
 }
@@ -737,7 +1397,7 @@ void coin_update(Item *item) {
   if (thing_collides_with_player(&item->thing)) {
     sfx(SFX_COIN_PICKUP);
     item->thing.removed = true;
-    coins++;
+    game->coins++;
   }
 }
 
@@ -747,7 +1407,8 @@ void coin_update(Item *item) {
 void potion_update(Item *item) {
   if (thing_collides_with_player(&item->thing)) {
     sfx(SFX_POTION_PICKUP);
-    main_player->creature.health = mini(main_player->creature.health + 1, 10);
+    object_touch(&game->objects[game->main_player->thing.id]);
+    game->main_player->creature.health = mini(game->main_player->creature.health + 1, 10);
     item->thing.removed = true;
   }
 }
@@ -757,7 +1418,7 @@ void potion_update(Item *item) {
 
 void key_update(Item *item) {
   if (thing_collides_with_player(&item->thing)) {
-    picked_keys++;
+    game->picked_keys++;
     sfx(SFX_KEY_PICKUP);
     item->thing.removed = true;
   }
@@ -805,14 +1466,15 @@ void auto_door_update(Item *item) {
       item->trigger_frame = riv->frame;
       item->thing.spawn_frame = riv->frame;
       item->thing.spr_frame_duration = 4;
+      thing_anim_restart(&item->thing);
       sfx(SFX_OPEN_DOOR);
     }
   } else if (riv->frame - item->trigger_frame > item->thing.spr_frame_duration &&
                thing_get_spr_anim(&item->thing, 0) == GFX_WALL_AUTO_DOOR) {
-    // spawn open door archs
-    spawn(GFX_WALL_DOOR_OPEN_TLR, MAP_LAYER_WALLS, item->thing.pos.x, item->thing.pos.y);
-    spawn(GFX_WALL_DOOR_OPEN_BL, MAP_LAYER_WALLS, item->thing.pos.x, item->thing.pos.y+TILE_PIXELS);
-    spawn(GFX_WALL_DOOR_OPEN_BR, MAP_LAYER_WALLS, item->thing.pos.x+TILE_PIXELS, item->thing.pos.y+TILE_PIXELS);
+    // place open door archs
+    tile_set(GFX_WALL_DOOR_OPEN_TLR, MAP_LAYER_WALLS, item->thing.pos.x / TILE_PIXELS, item->thing.pos.y / TILE_PIXELS);
+    tile_set(GFX_WALL_DOOR_OPEN_BL, MAP_LAYER_WALLS, item->thing.pos.x / TILE_PIXELS, item->thing.pos.y / TILE_PIXELS + 1);
+    tile_set(GFX_WALL_DOOR_OPEN_BR, MAP_LAYER_WALLS, item->thing.pos.x / TILE_PIXELS + 1, item->thing.pos.y / TILE_PIXELS + 1);
     // spawn open door ground
     item->thing.removed = true;
   }
@@ -820,18 +1482,19 @@ void auto_door_update(Item *item) {
 
 void closed_door_update(Item *item) {
   if (item->trigger_frame == 0) {
-    if (item->trigger_frame == 0 && picked_keys > 0 && player_get_dist_sqr(&item->thing) <= sqr(TILE_PIXELS*3)) {
+    if (item->trigger_frame == 0 && game->picked_keys > 0 && player_get_dist_sqr(&item->thing) <= sqr(TILE_PIXELS*3)) {
       item->trigger_frame = riv->frame;
       item->thing.spawn_frame = riv->frame;
       item->thing.spr_frame_duration = 4;
+      thing_anim_restart(&item->thing);
       sfx(SFX_OPEN_DOOR);
     }
   } else if (riv->frame - item->trigger_frame > item->thing.spr_frame_duration &&
                thing_get_spr_anim(&item->thing, 0) == GFX_WALL_CLOSED_DOOR) {
-    // spawn open door archs
-    spawn(GFX_WALL_DOOR_OPEN_TLR, MAP_LAYER_WALLS, item->thing.pos.x, item->thing.pos.y);
-    spawn(GFX_WALL_DOOR_OPEN_BL, MAP_LAYER_WALLS, item->thing.pos.x, item->thing.pos.y+TILE_PIXELS);
-    spawn(GFX_WALL_DOOR_OPEN_BR, MAP_LAYER_WALLS, item->thing.pos.x+TILE_PIXELS, item->thing.pos.y+TILE_PIXELS);
+    // place open door archs
+    tile_set(GFX_WALL_DOOR_OPEN_TLR, MAP_LAYER_WALLS, item->thing.pos.x / TILE_PIXELS, item->thing.pos.y / TILE_PIXELS);
+    tile_set(GFX_WALL_DOOR_OPEN_BL, MAP_LAYER_WALLS, item->thing.pos.x / TILE_PIXELS, item->thing.pos.y / TILE_PIXELS + 1);
+    tile_set(GFX_WALL_DOOR_OPEN_BR, MAP_LAYER_WALLS, item->thing.pos.x / TILE_PIXELS + 1, item->thing.pos.y / TILE_PIXELS + 1);
     // spawn open door ground
     item->thing.removed = true;
   }
@@ -849,6 +1512,7 @@ void effect_update(Effect *effect) {
 // Object
 
 void object_update(Object *object) {
+  PROFILE_ZONE(ZONE_OBJECT_UPDATE);
   switch(object->thing.spr) {
     case GFX_ITEM_COIN: coin_update(&object->item); break;
     case GFX_ITEM_KEY: key_update(&object->item); break;
@@ -876,162 +1540,1052 @@ void object_update(Object *object) {
   }
 }
 
+// whether object_update does something for it
+bool object_has_behavior(Object *object) {
+  switch(object->thing.spr) {
+    case GFX_ITEM_COIN:
+    case GFX_ITEM_KEY:
+    case GFX_ITEM_POTION:
+    case GFX_ITEM_CHEST:
+    case GFX_ITEM_CHEST_OPEN:
+    case GFX_ITEM_BOMB:
+    case GFX_ITEM_UPGRADE_BOMB:
+    case GFX_ITEM_UPGRADE_BLADE:
+    case GFX_MONSTER_SLIME_BOSS:
+    case GFX_GROUND_SPIKES:
+    case GFX_GROUND_STAIRS:
+    case GFX_WALL_AUTO_DOOR:
+    case GFX_WALL_CLOSED_DOOR:
+      return true;
+    default:
+      return (object->thing.type & (TYPE_CREATURE | TYPE_EFFECT)) != 0;
+  }
+}
+
 void object_draw(Object *object) {
   switch(object->thing.spr) {
     case GFX_MONSTER_SLIME_BOSS: slime_boss_draw(&object->monster); break;
     default: {
       switch (object->thing.type) {
-        case TYPE_MONSTER: monster_draw(&object->monster); break;
+        case TYPE_MONSTER: monster_draw(&object->monster, SPRITESHEET_GAME); break;
         case TYPE_PLAYER:
-        case TYPE_CREATURE: creature_draw(&object->creature, 0, 0, 0); break;
-        default: thing_draw(&object->thing, 0, 0, 0); break;
+        case TYPE_CREATURE: creature_draw(&object->creature, 0, SPRITESHEET_GAME, 0, 0); break;
+        default: thing_draw(&object->thing, 0, SPRITESHEET_GAME, 0, 0); break;
       }
     }
   }
 }
 
 //------------------------------------------------------------------------------
-// Map
+// Pools
 
-Object *spawn(u16 spr, u16 layer, f64 x, f64 y) {
-  if (object_count+1 >= MAX_OBJECTS) {
-    riv_printf("reached max objects\n");
-    return NULL;
-  }
-  Object *object_base = &gfx_objects[spr];
-  if (object_base->thing.removed) { // ignore objects that should not spawn
-    return NULL;
-  }
-  u32 id = object_count;
-  Object *object = &objects[id];
-  // try to reuse last object, otherwise generate a new one
-  if (object_count == 0 || !object->thing.removed || object->thing.type == TYPE_PLAYER) {
-    id = ++object_count;
-    object = &objects[id];
+u8 pool_for(Object *object) {
+  if (object->thing.type == TYPE_EFFECT) {
+    return POOL_EFFECTS;
+  } else if (object_has_behavior(object)) {
+    return POOL_ACTORS;
   }
-  *object = *object_base;
-  object->thing.id = id;
-  object->thing.spawn_pos = (vec2){x,y};
-  object->thing.pos = object->thing.spawn_pos;
-  object->thing.bbox = thing_bbox_at(&object->thing, object->thing.pos);
-  object->thing.layer = layer;
-  object->thing.spawn_frame = riv->frame;
-  if (object->thing.type == TYPE_NONE) { // define type from layer
-    switch (layer) {
-    case MAP_LAYER_GROUND: object->thing.type = TYPE_GROUND; break;
-    case MAP_LAYER_BOTTOM_ITEMS: object->thing.type = TYPE_ITEM; break;
-    case MAP_LAYER_CREATURES: object->thing.type = TYPE_MONSTER; break;
-    case MAP_LAYER_WALLS: object->thing.type = TYPE_WALL; break;
-    case MAP_LAYER_TOP_ITEMS: object->thing.type = TYPE_ITEM; break;
-    }
+  switch (object->thing.type) {
+    case TYPE_GROUND: return POOL_GROUND;
+    case TYPE_WALL: return POOL_WALLS;
+    default: return POOL_DECOR;
   }
-  return object;
 }
 
-recti get_camera_bbox() {
-  return (recti){main_player->thing.bbox.x - (SCREEN_PIXELS-TILE_PIXELS)/2,
-                 main_player->thing.bbox.y - (SCREEN_PIXELS-TILE_PIXELS)/2,
-                 SCREEN_PIXELS, SCREEN_PIXELS};
+void pools_clear() {
+  memset(game->pool_counts, 0, sizeof(game->pool_counts));
+  game->awake_count = 0;
 }
 
-void map_update() {
-  recti camera_bbox = get_camera_bbox();
-  recti screen_bbox = expand_recti(camera_bbox, TILE_PIXELS*2);
-  // update all objects not removed and in screen range
-  for (u32 i=1;i<=object_count;++i) {
-    Object *object = &objects[i];
-    if (!object->thing.removed && overlaps_recti(screen_bbox, object->thing.bbox)) {
-      object_update(&objects[i]);
-    }
+void pool_add(Object *object) {
+  u8 pool = pool_for(object);
+  object->thing.pool = pool;
+  game->pools[pool][game->pool_counts[pool]++] = object->thing.id;
+  if (pool == POOL_ACTORS) {
+    game->awake[game->awake_count++] = object->thing.id;
   }
 }
 
-void map_draw() {
-  riv_clear(RIV_COLOR_DARKSLATE);
-  recti camera_bbox = get_camera_bbox();
-  recti screen_bbox = expand_recti(camera_bbox, TILE_PIXELS*2);
-  riv->draw.origin.x = -camera_bbox.x;
-  riv->draw.origin.y = -camera_bbox.y;
-  if (shake_frame >= riv->frame) {
-    riv->draw.origin.x += riv_rand_uint(3);
-    riv->draw.origin.y += riv_rand_uint(3);
-  }
-  // draw all objects not removed and in screen range
-  for (u32 i=1;i<=object_count;++i) {
-    Object *object = &objects[i];
-    if (!object->thing.removed && overlaps_recti(screen_bbox, object->thing.bbox)) {
-      object_draw(&objects[i]);
+// drops removed objects keeping the spawn order, then frees their slots
+void pools_compact() {
+  for (u32 pool=POOL_ACTORS;pool<NUM_POOLS;++pool) {
+    u32 count = 0;
+    for (u32 i=0;i<game->pool_counts[pool];++i) {
+      u16 id = game->pools[pool][i];
+      if (!game->objects[id].thing.removed) {
+        game->pools[pool][count++] = id;
+      } else {
+        object_free(&game->objects[id]);
+      }
     }
+    game->pool_counts[pool] = count;
   }
-  riv->draw.origin.x = 0;
-  riv->draw.origin.y = 0;
+  u32 count = 0;
+  for (u32 i=0;i<game->awake_count;++i) {
+    u16 id = game->awake[i];
+    if (!game->objects[id].thing.removed && !game->objects[id].thing.asleep) {
+      game->awake[count++] = id;
+    }
+  }
+  game->awake_count = count;
 }
 
 //------------------------------------------------------------------------------
-// Game
+// Sleep
 
-void load_objects_types() {
-  for (u32 gfx=1;gfx<NUM_GFX;++gfx) {
-    Object *object = &gfx_objects[gfx];
-    if (memcmp(object, &gfx_objects[0], sizeof(Object)) == 0) {
-      object->thing.spr = gfx;
-    }
-    if (object->thing.spr_tiles.x == 0) {
-      object->thing.spr_tiles = (vec2i){1, 1};
-    }
-    if (object->thing.spr_scale.x == 0) {
-      object->thing.spr_scale = (vec2i){1, 1};
-    }
-    if (object->thing.spr != 0 && object->thing.spr_bbox.width == 0) {
-      object->thing.spr_bbox = riv_get_sprite_bbox(object->thing.spr, SPRITESHEET_GAME, object->thing.spr_tiles.x, object->thing.spr_tiles.y);
-    }
+// Actors that only react to the player coming near sleep while it is far, out
+// of the awake list, and are woken when it gets close again. Sleeping objects
+// are still drawn from their pools.
+
+enum {
+  WAKE_MARGIN = TILE_PIXELS*2, // more than the player can move in a frame
+  WAKE_CELLS = (TILE_PIXELS*3 + WAKE_MARGIN + TILE_PIXELS-1) / TILE_PIXELS, // cells scanned around the player
+};
+
+// distance to the player under which the object may act, negative when it must stay awake
+i64 object_wake_dist(Object *object) {
+  switch(object->thing.spr) {
+    case GFX_ITEM_COIN:
+    case GFX_ITEM_KEY:
+    case GFX_ITEM_POTION:
+    case GFX_GROUND_SPIKES:
+    case GFX_GROUND_STAIRS:
+      return TILE_PIXELS*2; // touching the player
+    case GFX_ITEM_CHEST:
+      return TILE_PIXELS*3/2;
+    case GFX_WALL_AUTO_DOOR:
+    case GFX_WALL_CLOSED_DOOR:
+      return object->item.trigger_frame == 0 ? TILE_PIXELS*3 : -1; // opening
+    default:
+      return -1;
+  }
+}
+
+bool object_near_player(Object *object, i64 dist) {
+  vec2 delta = sub_vec2(object->thing.pos, game->main_player->thing.pos);
+  return fabs(delta.x) <= dist + WAKE_MARGIN && fabs(delta.y) <= dist + WAKE_MARGIN;
+}
+
+bool object_can_sleep(Object *object) {
+  if (object->thing.spr == GFX_ITEM_CHEST_OPEN) { // done dropping coins
+    return riv->frame - object->item.trigger_frame > 40;
+  }
+  i64 dist = object_wake_dist(object);
+  return dist >= 0 && !object_near_player(object, dist);
+}
+
+void sleep_clear() {
+  for (u32 i=1;i<=game->object_count;++i) {
+    game->objects[i].thing.asleep = false;
+  }
+  memset(game->sleep_cells, 0, sizeof(game->sleep_cells));
+}
+
+u16 sleep_cell_at(vec2 pos) {
+  return grid_cell_coord(pos.y) * MAP_SIZE + grid_cell_coord(pos.x);
+}
+
+void object_sleep(Object *object) {
+  Thing *thing = &object->thing;
+  thing->asleep = true;
+  thing->sleep_cell = sleep_cell_at(thing->pos);
+  thing->sleep_next = game->sleep_cells[thing->sleep_cell];
+  game->sleep_cells[thing->sleep_cell] = thing->id;
+}
+
+void sleep_unlink(Thing *thing) {
+  if (!thing->asleep) {
+    return;
+  }
+  u16 *link = &game->sleep_cells[thing->sleep_cell];
+  while (*link != thing->id) {
+    link = &game->objects[*link].thing.sleep_next;
+  }
+  *link = thing->sleep_next;
+  thing->asleep = false;
+}
+
+// insert back in the awake list keeping the spawn order
+void object_wake(Object *object) {
+  sleep_unlink(&object->thing);
+  u32 i = game->awake_count;
+  while (i > 0 && game->objects[game->awake[i-1]].thing.seq > object->thing.seq) {
+    game->awake[i] = game->awake[i-1];
+    i--;
+  }
+  game->awake[i] = object->thing.id;
+  game->awake_count++;
+}
+
+void wake_near_player() {
+  i64 cx = grid_cell_coord(game->main_player->thing.pos.x), cy = grid_cell_coord(game->main_player->thing.pos.y);
+  for (i64 y=maxi(cy-WAKE_CELLS, 0);y<=mini(cy+WAKE_CELLS, MAP_SIZE-1);++y) {
+    for (i64 x=maxi(cx-WAKE_CELLS, 0);x<=mini(cx+WAKE_CELLS, MAP_SIZE-1);++x) {
+      u16 id = game->sleep_cells[y*MAP_SIZE + x];
+      while (id != 0) {
+        Object *object = &game->objects[id];
+        id = object->thing.sleep_next;
+        if (object->thing.removed) {
+          sleep_unlink(&object->thing);
+        } else if (object_near_player(object, object_wake_dist(object))) {
+          object_wake(object);
+        }
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Tilemap
+
+// Static ground and wall cells are not objects, they are drawn straight from
+// the tiles array. Cells that animate, have behavior or change at runtime
+// override it by spawning objects instead.
+
+u8 layer_type(u8 layer) {
+  switch (layer) {
+    case MAP_LAYER_GROUND: return TYPE_GROUND;
+    case MAP_LAYER_BOTTOM_ITEMS: return TYPE_ITEM;
+    case MAP_LAYER_CREATURES: return TYPE_MONSTER;
+    case MAP_LAYER_WALLS: return TYPE_WALL;
+    case MAP_LAYER_TOP_ITEMS: return TYPE_ITEM;
+    default: return TYPE_NONE;
+  }
+}
+
+Object tile_object(u16 gfx, u8 layer, i64 x, i64 y) {
+  Object object = gfx_objects[gfx];
+  object.thing.layer = layer;
+  object.thing.pos = (vec2){x * TILE_PIXELS, y * TILE_PIXELS};
+  object.thing.bbox = thing_bbox_at(&object.thing, object.thing.pos);
+  if (object.thing.type == TYPE_NONE) {
+    object.thing.type = layer_type(layer);
+  }
+  return object;
+}
+
+bool tile_is_static(u16 gfx, u8 layer, i64 x, i64 y) {
+  Object object = tile_object(gfx, layer, x, y);
+  if (object.thing.spr_frame_duration > 0 || object_has_behavior(&object)) {
+    return false;
+  }
+  switch (layer) {
+    case MAP_LAYER_GROUND: return object.thing.type == TYPE_GROUND;
+    case MAP_LAYER_WALLS: return object.thing.phantom || thing_is_static_wall(&object.thing);
+    default: return false;
+  }
+}
+
+void chunks_invalidate(u8 layer, i64 x, i64 y, i64 w, i64 h);
+
+// Levels are stored sparse, see maps/conv.lua, each map layer is a u16 count
+// of non-empty cells followed by that many cells as a u16 y*MAP_SIZE+x index
+// and a u8 gfx, in row order, little endian.
+
+enum {
+  MAP_CELL_BYTES = 3,
+};
+
+u16 map_read_u16(const u8 *data) {
+  return data[0] | data[1] << 8;
+}
+
+// Maps every level file found, the pages of a level are only read from the
+// cartridge once load_map walks its cells.
+void load_levels() {
+  if (num_levels > 0) { // already mapped, levels are shared by every game
+    return;
+  }
+  for (i64 i=0;i<MAX_LEVELS;++i) {
+    int fd = open(riv_tprintf("level%d.bin", (int)i+1), O_RDONLY);
+    if (fd < 0) {
+      break;
+    }
+    struct stat st;
+    void *data = fstat(fd, &st) == 0 && st.st_size > 0 ?
+      mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+      riv_panic("failed to map level file");
+    }
+    levels[i].data = data;
+    levels[i].size = st.st_size;
+    num_levels = i+1;
+  }
+  if (num_levels == 0) {
+    riv_panic("no level files found");
+  }
+}
+
+// checks the layers of a level fit in its file and every cell lies on the map
+// with a known gfx, as level files are not trusted
+void map_level_check(u64 level) {
+  const u8 *data = levels[level].data;
+  u64 offset = 0;
+  for (u8 l=0;l<NUM_MAP_LAYERS;++l) {
+    if (offset+2 > levels[level].size) {
+      riv_panic("truncated level file");
+    }
+    u16 count = map_read_u16(data + offset);
+    offset += 2;
+    if (offset + (u64)count*MAP_CELL_BYTES > levels[level].size) {
+      riv_panic("truncated level file");
+    }
+    for (u16 i=0;i<count;++i,offset+=MAP_CELL_BYTES) {
+      u16 cell = map_read_u16(data + offset);
+      Thing *thing = &gfx_objects[data[offset+2]].thing;
+      if (cell >= MAP_SIZE*MAP_SIZE || data[offset+2] == 0 || (thing->spr == 0 && !thing->removed)) {
+        riv_panic("invalid level cell");
+      }
+    }
+  }
+}
+
+// first layer of a level, checked once
+const u8 *map_level_data(u64 level) {
+  if (!atomic_load(&levels[level].checked)) {
+    map_level_check(level);
+    atomic_store(&levels[level].checked, true);
+  }
+  return levels[level].data;
+}
+
+// expands all cells of a level, empty ones included
+void map_decode(u64 level, u8 cells[NUM_MAP_LAYERS][MAP_SIZE][MAP_SIZE]) {
+  memset(cells, 0, NUM_MAP_LAYERS*MAP_SIZE*MAP_SIZE);
+  const u8 *data = map_level_data(level);
+  for (u8 l=0;l<NUM_MAP_LAYERS;++l) {
+    u16 count = map_read_u16(data);
+    data += 2;
+    for (u16 i=0;i<count;++i,data+=MAP_CELL_BYTES) {
+      u16 cell = map_read_u16(data);
+      cells[l][cell / MAP_SIZE][cell % MAP_SIZE] = data[2];
+    }
+  }
+}
+
+void tiles_clear() {
+  memset(game->tiles, 0, sizeof(game->tiles));
+  memset(game->chunk_dirty, 1, sizeof(game->chunk_dirty));
+}
+
+void tile_set(u16 gfx, u8 layer, i64 x, i64 y) {
+  if (gfx_objects[gfx].thing.removed) { // ignore cells covered by a multi tile sprite
+    return;
+  }
+  game->tiles[layer][y][x] = gfx;
+  Object object = tile_object(gfx, layer, x, y);
+  chunks_invalidate(layer, x, y, object.thing.spr_tiles.x, object.thing.spr_tiles.y);
+  if (thing_is_static_wall(&object.thing)) {
+    wall_mask_fill(object.thing.bbox);
+  }
+}
+
+void tiles_draw(u8 layer, recti camera_bbox) {
+  // start one tile before, as multi tile sprites may cover the first cells
+  i64 x0 = clampi(camera_bbox.x / TILE_PIXELS - 1, 0, MAP_SIZE-1);
+  i64 y0 = clampi(camera_bbox.y / TILE_PIXELS - 1, 0, MAP_SIZE-1);
+  i64 x1 = clampi((camera_bbox.x + camera_bbox.width - 1) / TILE_PIXELS, 0, MAP_SIZE-1);
+  i64 y1 = clampi((camera_bbox.y + camera_bbox.height - 1) / TILE_PIXELS, 0, MAP_SIZE-1);
+  // disable blending for opaque ground sprites (optimization)
+  riv->draw.color_key_disabled = layer == MAP_LAYER_GROUND;
+  for (i64 y=y0;y<=y1;++y) {
+    for (i64 x=x0;x<=x1;++x) {
+      u16 gfx = game->tiles[layer][y][x];
+      if (gfx != 0) {
+        Thing *thing = &gfx_objects[gfx].thing;
+        riv_draw_sprite(gfx, SPRITESHEET_GAME, x * TILE_PIXELS, y * TILE_PIXELS,
+                        thing->spr_tiles.x, thing->spr_tiles.y, thing->spr_scale.x, thing->spr_scale.y);
+      }
+    }
+  }
+  riv->draw.color_key_disabled = false;
+}
+
+//------------------------------------------------------------------------------
+// Chunk cache
+
+// Static tiles are composited once into screen sized chunks, then copied to
+// the framebuffer every frame. Chunks are composited again only when a tile
+// inside them changes, objects keep being drawn on top of them.
+
+u8 chunk_layer(u8 layer) {
+  return layer == MAP_LAYER_WALLS ? CHUNK_LAYER_WALLS : CHUNK_LAYER_GROUND;
+}
+
+recti chunk_bbox(i64 cx, i64 cy) {
+  return (recti){cx * CHUNK_PIXELS, cy * CHUNK_PIXELS, CHUNK_PIXELS, CHUNK_PIXELS};
+}
+
+void chunks_invalidate(u8 layer, i64 x, i64 y, i64 w, i64 h) {
+  i64 cx0 = x / CHUNK_TILES, cy0 = y / CHUNK_TILES;
+  i64 cx1 = clampi((x + w - 1) / CHUNK_TILES, 0, NUM_CHUNKS-1);
+  i64 cy1 = clampi((y + h - 1) / CHUNK_TILES, 0, NUM_CHUNKS-1);
+  for (i64 cy=cy0;cy<=cy1;++cy) {
+    for (i64 cx=cx0;cx<=cx1;++cx) {
+      game->chunk_dirty[chunk_layer(layer)][cy][cx] = true;
+    }
+  }
+}
+
+// uses the framebuffer as scratch, so it must be called before drawing a frame
+void chunk_build(u8 layer, i64 cx, i64 cy) {
+  u8 *pixels = game->chunk_pixels[chunk_layer(layer)][cy][cx];
+  recti bbox = chunk_bbox(cx, cy);
+  riv_vec2i origin = riv->draw.origin;
+  riv->draw.origin = (riv_vec2i){-bbox.x, -bbox.y};
+  riv_clear(RIV_COLOR_DARKSLATE);
+  tiles_draw(layer, bbox);
+  memcpy(pixels, riv->framebuffer, CHUNK_PIXELS*CHUNK_PIXELS);
+  if (layer == MAP_LAYER_WALLS) {
+    // pixels not covered by a sprite follow the clear color, compose again over another one to find them
+    u64 (*opaque)[CHUNK_MASK_WORDS] = game->chunk_opaque[cy][cx];
+    memset(opaque, 0, sizeof(game->chunk_opaque[cy][cx]));
+    riv_clear(RIV_COLOR_BLACK);
+    tiles_draw(layer, bbox);
+    for (i64 y=0;y<CHUNK_PIXELS;++y) {
+      for (i64 x=0;x<CHUNK_PIXELS;++x) {
+        if (pixels[y*CHUNK_PIXELS + x] == riv->framebuffer[y*SCREEN_PIXELS + x]) {
+          opaque[y][x / 64] |= 1ULL << (x % 64);
+        }
+      }
+    }
+  }
+  riv->draw.origin = origin;
+  game->chunk_dirty[chunk_layer(layer)][cy][cx] = false;
+}
+
+recti chunks_view() {
+  return (recti){-riv->draw.origin.x, -riv->draw.origin.y, SCREEN_PIXELS, SCREEN_PIXELS};
+}
+
+void chunks_build(u8 layer) {
+  recti view = chunks_view();
+  for (i64 cy=0;cy<NUM_CHUNKS;++cy) {
+    for (i64 cx=0;cx<NUM_CHUNKS;++cx) {
+      if (game->chunk_dirty[chunk_layer(layer)][cy][cx] && overlaps_recti(view, chunk_bbox(cx, cy))) {
+        chunk_build(layer, cx, cy);
+      }
+    }
+  }
+}
+
+void chunks_draw(u8 layer) {
+  recti view = chunks_view();
+  for (i64 cy=0;cy<NUM_CHUNKS;++cy) {
+    for (i64 cx=0;cx<NUM_CHUNKS;++cx) {
+      recti bbox = chunk_bbox(cx, cy);
+      if (!overlaps_recti(view, bbox)) {
+        continue;
+      }
+      u8 *pixels = game->chunk_pixels[chunk_layer(layer)][cy][cx];
+      u64 (*opaque)[CHUNK_MASK_WORDS] = game->chunk_opaque[cy][cx];
+      // clip chunk to the screen
+      i64 sx = bbox.x - view.x, sy = bbox.y - view.y;
+      i64 x0 = maxi(-sx, 0), x1 = mini(SCREEN_PIXELS - sx, CHUNK_PIXELS);
+      i64 y0 = maxi(-sy, 0), y1 = mini(SCREEN_PIXELS - sy, CHUNK_PIXELS);
+      for (i64 y=y0;y<y1;++y) {
+        u8 *src = &pixels[y*CHUNK_PIXELS];
+        u8 *dst = &riv->framebuffer[(sy + y)*SCREEN_PIXELS + sx];
+        if (layer != MAP_LAYER_WALLS) {
+          memcpy(&dst[x0], &src[x0], x1 - x0);
+          continue;
+        }
+        for (i64 x=x0;x<x1;++x) {
+          if (opaque[y][x / 64] & (1ULL << (x % 64))) {
+            dst[x] = src[x];
+          }
+        }
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Digest
+
+// The digest and dump cover simulation fields by value, never raw struct
+// bytes, so builds from different compilers or targets can be compared.
+
+u64 digest_mix(u64 h, u64 v) {
+  h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+  return h ^ (h >> 29);
+}
+
+u64 digest_f32(u64 h, f32 v) {
+  u32 bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return digest_mix(h, bits);
+}
+
+u64 digest_f64(u64 h, f64 v) {
+  u64 bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return digest_mix(h, bits);
+}
+
+u64 object_digest(u64 h, Object *object) {
+  Thing *thing = &object->thing;
+  h = digest_mix(h, thing->type | (u64)thing->spr << 8 | (u64)thing->layer << 24 | (u64)thing->removed << 32);
+  h = digest_mix(h, thing->id | (u64)thing->gen << 16 | (u64)thing->seq << 32);
+  h = digest_mix(h, thing->spawn_frame);
+  h = digest_f32(h, thing->pos.x);
+  h = digest_f32(h, thing->pos.y);
+  h = digest_mix(h, (u64)thing->bbox.x << 32 ^ (u64)thing->bbox.y);
+  h = digest_mix(h, (u64)thing->bbox.width << 32 ^ (u64)thing->bbox.height);
+  h = digest_mix(h, (u64)thing->spr_scale.x << 32 ^ (u64)thing->spr_scale.y);
+  if (thing->type & TYPE_CREATURE) {
+    Creature *creature = &object->creature;
+    h = digest_mix(h, creature->health);
+    h = digest_f64(h, creature->slowdown);
+    h = digest_mix(h, creature->slowdown_until_frame);
+    h = digest_mix(h, creature->attack1_frame);
+    h = digest_mix(h, creature->attack2_frame);
+    h = digest_mix(h, creature->hurt_frame);
+    h = digest_mix(h, creature->die_frame);
+    h = digest_mix(h, creature->attack1_damage | (u64)creature->attack2_damage << 16 |
+                      (u64)creature->attack1_delay << 32 | (u64)creature->attack2_delay << 48);
+    if (thing->type == TYPE_PLAYER) {
+      h = digest_mix(h, object->player.dash_frame);
+    }
+  } else {
+    h = digest_mix(h, object->item.trigger_frame);
+    h = digest_mix(h, object->item.damage);
+  }
+  return h;
+}
+
+// Objects add their digest to a rolling sum, only objects that changed in the
+// frame are hashed again, so the state hash costs almost nothing to keep.
+// Removed objects add nothing, so freeing or reusing their slot needs no care.
+
+u64 object_term(Object *object) {
+  return object->thing.removed ? 0 : object_digest(0, object);
+}
+
+// marks an object changed in the current frame
+void object_touch(Object *object) {
+  if (!object->thing.touched) {
+    object->thing.touched = true;
+    game->touched[game->touched_count++] = object->thing.id;
+  }
+}
+
+// hashes all objects, when most of them changed or moved to other slots
+void state_hash_rebuild() {
+  game->state_hash = 0;
+  for (u32 i=1;i<=game->object_count;++i) {
+    Object *object = &game->objects[i];
+    object->thing.digest = object_term(object);
+    object->thing.touched = false;
+    game->state_hash += object->thing.digest;
+  }
+  game->touched_count = 0;
+}
+
+// hashes again the objects changed in the current frame
+void state_hash_update() {
+  for (u32 i=0;i<game->touched_count;++i) {
+    Object *object = &game->objects[game->touched[i]];
+    u64 term = object_term(object);
+    game->state_hash += term - object->thing.digest;
+    object->thing.digest = term;
+    object->thing.touched = false;
+  }
+  game->touched_count = 0;
+#ifdef DEBUG_STATE_HASH
+  u64 state_hash = game->state_hash;
+  state_hash_rebuild();
+  if (state_hash != game->state_hash) {
+    riv_panic("state hash missed an object change");
+  }
+#endif
+}
+
+// hash of the whole simulation state
+u64 game_digest() {
+  u64 h = digest_mix(0, riv->frame);
+  h = digest_mix(h, riv->quit_frame);
+  h = digest_mix(h, game->level | (u64)game->next_level << 8 | (u64)game->object_count << 16);
+  h = digest_mix(h, game->kills);
+  h = digest_mix(h, game->coins);
+  h = digest_mix(h, game->picked_keys);
+  h = digest_mix(h, game->shake_frame);
+  h = digest_mix(h, game->end_frame);
+  return digest_mix(h, game->state_hash);
+}
+
+// prints the fields covered by the digest, one line per object
+void game_dump() {
+  riv_printf("game frame=%lu quit_frame=%lu level=%ld next_level=%ld object_count=%u kills=%ld coins=%ld keys=%ld shake_frame=%lu end_frame=%lu\n",
+    riv->frame, riv->quit_frame, game->level, game->next_level, game->object_count,
+    game->kills, game->coins, game->picked_keys, game->shake_frame, game->end_frame);
+  for (u32 i=1;i<=game->object_count;++i) {
+    Object *object = &game->objects[i];
+    Thing *thing = &object->thing;
+    riv_printf("object %u type=%u spr=%u layer=%u removed=%d gen=%u seq=%u spawn_frame=%lu pos=%a,%a bbox=%ld,%ld,%ld,%ld scale=%ld,%ld",
+      i, thing->type, thing->spr, thing->layer, thing->removed, thing->gen, thing->seq, thing->spawn_frame,
+      thing->pos.x, thing->pos.y, thing->bbox.x, thing->bbox.y, thing->bbox.width, thing->bbox.height,
+      thing->spr_scale.x, thing->spr_scale.y);
+    if (thing->type & TYPE_CREATURE) {
+      Creature *creature = &object->creature;
+      riv_printf(" health=%ld slowdown=%a slowdown_until_frame=%lu attack1_frame=%lu attack2_frame=%lu hurt_frame=%lu die_frame=%lu attack=%u,%u,%u,%u",
+        creature->health, creature->slowdown, creature->slowdown_until_frame, creature->attack1_frame,
+        creature->attack2_frame, creature->hurt_frame, creature->die_frame, creature->attack1_damage,
+        creature->attack2_damage, creature->attack1_delay, creature->attack2_delay);
+      if (thing->type == TYPE_PLAYER) {
+        riv_printf(" dash_frame=%lu", object->player.dash_frame);
+      }
+    } else {
+      riv_printf(" trigger_frame=%lu damage=%ld", object->item.trigger_frame, object->item.damage);
+    }
+    riv_printf("\n");
+  }
+}
+
+//------------------------------------------------------------------------------
+// Map
+
+Handle object_handle(Object *object) {
+  return (Handle){object->thing.id, object->thing.gen};
+}
+
+// returns the object of a handle, or NULL when its slot was reused or moved since
+Object *handle_get(Handle handle) {
+  Object *object = &game->objects[handle.id];
+  return object->thing.gen == handle.gen ? object : NULL;
+}
+
+// refreshes the cached main player pointer from its handle once objects moved,
+// returns false when the handle no longer refers to a player
+bool main_player_resolve() {
+  Object *object = handle_get(game->main_player_handle);
+  game->main_player = object && object->thing.type == TYPE_PLAYER ? &object->player : NULL;
+  return game->main_player != NULL;
+}
+
+// called once a removed object left its pool
+void object_free(Object *object) {
+  if (object->thing.type == TYPE_PLAYER) { // main_player_handle keeps referring to it
+    return;
+  }
+  grid_unlink(&object->thing);
+  sleep_unlink(&object->thing);
+  game->free_ids[game->free_count++] = object->thing.id;
+}
+
+Object *spawn(u16 spr, u16 layer, f64 x, f64 y) {
+  PROFILE_ZONE(ZONE_SPAWN);
+  if (game->free_count == 0 && game->object_count+1 >= MAX_OBJECTS) {
+    riv_printf("reached max objects\n");
+    return NULL;
+  }
+  Object *object_base = &gfx_objects[spr];
+  if (object_base->thing.removed) { // ignore objects that should not spawn
+    return NULL;
+  }
+  // reuse a freed slot, otherwise take a new one
+  u32 id = game->free_count > 0 ? game->free_ids[--game->free_count] : ++game->object_count;
+  Object *object = &game->objects[id];
+  u16 gen = object->thing.gen + 1;
+  *object = *object_base;
+  object->thing.id = id;
+  object->thing.gen = gen;
+  object->thing.seq = ++game->spawn_count;
+  object->thing.spawn_pos = (vec2){x,y};
+  object->thing.pos = object->thing.spawn_pos;
+  object->thing.bbox = thing_bbox_at(&object->thing, object->thing.pos);
+  object->thing.layer = layer;
+  object->thing.spawn_frame = riv->frame;
+  thing_anim_restart(&object->thing);
+  if (object->thing.type == TYPE_NONE) { // define type from layer
+    object->thing.type = layer_type(layer);
+  }
+  if (thing_is_static_wall(&object->thing)) {
+    wall_mask_fill(object->thing.bbox);
+  } else {
+    grid_link(&object->thing);
+  }
+  pool_add(object);
+  object_touch(object);
+  return object;
+}
+
+// Freed slots are reused, still a long fight can leave many holes in objects[].
+// Compaction squeezes live objects to its front keeping their slot order, then
+// remaps the ids kept in pools, lists, cells and handles. Load map already
+// spawns objects densely.
+
+enum {
+  COMPACT_MIN_FREE = 256,
+};
+
+bool objects_need_compact() {
+  return game->free_count >= COMPACT_MIN_FREE && game->free_count*4 >= game->object_count && !game->main_player->thing.removed;
+}
+
+void objects_compact() {
+  Object *player = handle_get(game->main_player_handle);
+  if (!player) {
+    riv_panic("stale main player handle");
+  }
+  u16 player_id = player->thing.id;
+  u32 count = 0;
+  game->compact_ids[0] = 0;
+  for (u32 i=1;i<=game->object_count;++i) {
+    game->compact_ids[i] = game->objects[i].thing.removed ? 0 : ++count;
+  }
+  for (u32 i=1;i<=game->object_count;++i) {
+    u16 id = game->compact_ids[i];
+    if (id == 0 || id == i) {
+      continue;
+    }
+    u16 gen = game->objects[id].thing.gen + 1;
+    game->objects[id] = game->objects[i];
+    game->objects[id].thing.id = id;
+    game->objects[id].thing.gen = gen;
+    // leave the old slot removed with a new generation, so handles to it fail
+    game->objects[i].thing.removed = true;
+    game->objects[i].thing.gen++;
+  }
+  for (u32 i=1;i<=count;++i) {
+    Thing *thing = &game->objects[i].thing;
+    thing->cell_prev = game->compact_ids[thing->cell_prev];
+    thing->cell_next = game->compact_ids[thing->cell_next];
+    thing->sleep_next = game->compact_ids[thing->sleep_next];
+  }
+  for (u32 i=0;i<MAP_SIZE*MAP_SIZE;++i) {
+    game->grid_cells[i] = game->compact_ids[game->grid_cells[i]];
+    game->sleep_cells[i] = game->compact_ids[game->sleep_cells[i]];
+  }
+  for (u32 pool=0;pool<NUM_POOLS;++pool) {
+    for (u32 i=0;i<game->pool_counts[pool];++i) {
+      game->pools[pool][i] = game->compact_ids[game->pools[pool][i]];
+    }
+  }
+  for (u32 i=0;i<game->awake_count;++i) {
+    game->awake[i] = game->compact_ids[game->awake[i]];
+  }
+  game->main_player_handle = object_handle(&game->objects[game->compact_ids[player_id]]);
+  main_player_resolve();
+  game->object_count = count;
+  game->free_count = 0;
+  state_hash_rebuild();
+}
+
+recti get_camera_bbox() {
+  return (recti){game->main_player->thing.bbox.x - (SCREEN_PIXELS-TILE_PIXELS)/2,
+                 game->main_player->thing.bbox.y - (SCREEN_PIXELS-TILE_PIXELS)/2,
+                 SCREEN_PIXELS, SCREEN_PIXELS};
+}
+
+void map_update() {
+  PROFILE_ZONE(ZONE_MAP_UPDATE);
+  recti camera_bbox = get_camera_bbox();
+  recti screen_bbox = expand_recti(camera_bbox, TILE_PIXELS*2);
+  // update awake actors and effects not removed and in screen range
+  wake_near_player();
+  for (u32 i=0;i<game->awake_count;++i) {
+    Object *object = &game->objects[game->awake[i]];
+    if (object->thing.removed) {
+      continue;
+    } else if (object_can_sleep(object)) {
+      object_sleep(object);
+    } else if (overlaps_recti(screen_bbox, object->thing.bbox)) {
+      object_update(object);
+      object_touch(object);
+    }
+  }
+  for (u32 i=0;i<game->pool_counts[POOL_EFFECTS];++i) {
+    Object *object = &game->objects[game->pools[POOL_EFFECTS][i]];
+    if (!object->thing.removed && overlaps_recti(screen_bbox, object->thing.bbox)) {
+      object_update(object);
+      object_touch(object);
+    }
+  }
+  pools_compact();
+  state_hash_update();
+  if (objects_need_compact()) {
+    objects_compact();
+  }
+}
+
+// Objects not removed and in screen range are bucketed by layer, keeping the
+// pools order, then creatures are ordered by their bbox bottom so the ones in
+// front cover the ones behind. Both are stable counting sorts, linear in the
+// number of visible objects.
+
+enum {
+  DRAW_SORT_ROWS = SCREEN_PIXELS + TILE_PIXELS*8, // bbox bottoms a visible creature can have
+};
+
+u32 draw_sort_row(Object *object, i64 top) {
+  return mini(maxi(object->thing.bbox.y + object->thing.bbox.height - top, 0), DRAW_SORT_ROWS-1);
+}
+
+void draw_sort_by_bottom(u32 start, u32 end, i64 top) {
+  u32 row_starts[DRAW_SORT_ROWS+1] = {0};
+  for (u32 i=start;i<end;++i) {
+    row_starts[draw_sort_row(&game->objects[game->draw_ids[i]], top) + 1]++;
+  }
+  for (u32 row=1;row<=DRAW_SORT_ROWS;++row) {
+    row_starts[row] += row_starts[row-1];
+  }
+  for (u32 i=start;i<end;++i) {
+    game->draw_sort_ids[row_starts[draw_sort_row(&game->objects[game->draw_ids[i]], top)]++] = game->draw_ids[i];
+  }
+  memcpy(&game->draw_ids[start], game->draw_sort_ids, (end - start)*sizeof(u16));
+}
+
+void draw_lists_build(recti screen_bbox) {
+  u32 layer_counts[NUM_DRAW_LAYERS] = {0};
+  u32 count = 0;
+  for (u32 pool=0;pool<NUM_POOLS;++pool) {
+    for (u32 i=0;i<game->pool_counts[pool];++i) {
+      Object *object = &game->objects[game->pools[pool][i]];
+      if (!object->thing.removed && overlaps_recti(screen_bbox, object->thing.bbox)) {
+        game->draw_sort_ids[count++] = object->thing.id;
+        layer_counts[object->thing.layer]++;
+      }
+    }
+  }
+  u32 next[NUM_DRAW_LAYERS];
+  game->draw_starts[0] = 0;
+  for (u8 layer=0;layer<NUM_DRAW_LAYERS;++layer) {
+    next[layer] = game->draw_starts[layer];
+    game->draw_starts[layer+1] = game->draw_starts[layer] + layer_counts[layer];
+  }
+  for (u32 i=0;i<count;++i) {
+    u16 id = game->draw_sort_ids[i];
+    game->draw_ids[next[game->objects[id].thing.layer]++] = id;
+  }
+  draw_sort_by_bottom(game->draw_starts[MAP_LAYER_CREATURES], game->draw_starts[MAP_LAYER_CREATURES+1], screen_bbox.y);
+}
+
+void map_draw() {
+  PROFILE_ZONE(ZONE_MAP_DRAW);
+  recti camera_bbox = get_camera_bbox();
+  recti screen_bbox = expand_recti(camera_bbox, TILE_PIXELS*2);
+  riv->draw.origin.x = -camera_bbox.x + game->shake_offset.x;
+  riv->draw.origin.y = -camera_bbox.y + game->shake_offset.y;
+  chunks_build(MAP_LAYER_GROUND);
+  chunks_build(MAP_LAYER_WALLS);
+  // ground chunks are opaque and cover the whole map, clear only when the view leaves it
+  recti view = chunks_view();
+#ifndef DEBUG_FULL_REDRAW
+  if (view.x < 0 || view.y < 0 || view.x + view.width > MAP_PIXELS || view.y + view.height > MAP_PIXELS)
+#endif
+  {
+    riv_clear(RIV_COLOR_DARKSLATE);
+  }
+  draw_lists_build(screen_bbox);
+  // draw static tiles and the visible objects, layer by layer
+  for (u8 layer=MAP_LAYER_GROUND;layer<NUM_DRAW_LAYERS;++layer) {
+    if (layer == MAP_LAYER_GROUND || layer == MAP_LAYER_WALLS) {
+      chunks_draw(layer);
+    }
+    for (u32 i=game->draw_starts[layer];i<game->draw_starts[layer+1];++i) {
+      object_draw(&game->objects[game->draw_ids[i]]);
+    }
+  }
+  riv->draw.origin.x = 0;
+  riv->draw.origin.y = 0;
+}
+
+//------------------------------------------------------------------------------
+// Game
+
+bool gfx_objects_loaded; // prototypes are shared by all games, fill them only once
+
+// Sprite offset of each animation step, a step counts spr_frame_duration
+// frames, the loop delay steps hold the first frame. Multi-row sprites skip
+// the rows of the tiles below when the animation wraps to the next row.
+// The offset only depends on the sprite column, so it also holds for the
+// sprites that creatures draw one row below their own.
+void anim_table_build(Thing* thing, u16 *offsets) {
+  u32 steps = thing->spr_frames + thing->spr_loop_delay;
+  if (thing->spr_frames == 0) {
+    return;
+  }
+  if (steps > MAX_ANIM_STEPS) {
+    riv_panic("too many animation steps");
+  }
+  for (u32 step=0;step<steps;++step) {
+    u32 frame = maxi((i64)step - thing->spr_loop_delay, 0);
+    u32 anim_spr = thing->spr + frame * thing->spr_tiles.x;
+    offsets[step] = anim_spr - thing->spr + ((anim_spr / SPRITESHEET_COLUMNS) - (thing->spr / SPRITESHEET_COLUMNS)) *
+                                            (thing->spr_tiles.y - 1) * SPRITESHEET_COLUMNS;
+  }
+}
+
+void load_objects_types() {
+  if (gfx_objects_loaded) {
+    return;
+  }
+  gfx_objects_loaded = true;
+  for (u32 gfx=1;gfx<NUM_GFX;++gfx) {
+    Object *object = &gfx_objects[gfx];
+    if (memcmp(object, &gfx_objects[0], sizeof(Object)) == 0) {
+      object->thing.spr = gfx;
+    }
+    if (object->thing.spr_tiles.x == 0) {
+      object->thing.spr_tiles = (vec2i){1, 1};
+    }
+    if (object->thing.spr_scale.x == 0) {
+      object->thing.spr_scale = (vec2i){1, 1};
+    }
+    if (object->thing.spr != 0 && object->thing.spr_bbox.width == 0) {
+      object->thing.spr_bbox = riv_get_sprite_bbox(object->thing.spr, SPRITESHEET_GAME, object->thing.spr_tiles.x, object->thing.spr_tiles.y);
+    }
+    object->thing.anim = gfx;
+    anim_table_build(&object->thing, gfx_anims[gfx]);
   }
 }
 
 void load_map(u64 new_level) {
-  Player prev_player = (main_player && !main_player->thing.removed) ? *main_player : gfx_objects[GFX_PLAYER].player;
-  level = new_level;
-  next_level = new_level;
-  main_player = NULL;
-  first_collidable = NULL;
-  object_count = 0;
-  picked_keys = 0;
-  shake_frame = 0;
+  Player prev_player = (game->main_player && !game->main_player->thing.removed) ? *game->main_player : gfx_objects[GFX_PLAYER].player;
+  game->level = new_level;
+  game->next_level = new_level;
+  game->main_player = NULL;
+  game->first_collidable = 0;
+  grid_clear();
+  sleep_clear();
+  wall_mask_clear();
+  tiles_clear();
+  pools_clear();
+  game->object_count = 0;
+  game->free_count = 0;
+  game->spawn_count = 0;
+  game->picked_keys = 0;
+  game->shake_frame = 0;
+  const u8 *data = map_level_data(game->level);
   for (u8 l=0;l<NUM_MAP_LAYERS;++l) {
-    for (u16 y=0;y<MAP_SIZE;++y) {
-      for (u16 x=0;x<MAP_SIZE;++x) {
-        u16 gfx = maps[level][l][y][x];
-        if (gfx != 0) {
-          Object *object = spawn(gfx, l, x * TILE_PIXELS, y * TILE_PIXELS);
-          if (object) {
-            if (object->thing.type == TYPE_PLAYER) {
-              main_player = &object->player;
-              prev_player.thing.id = main_player->thing.id;
-              prev_player.thing.spawn_pos = main_player->thing.spawn_pos;
-              prev_player.thing.pos = main_player->thing.pos;
-              prev_player.thing.bbox = main_player->thing.bbox;
-              prev_player.thing.layer = main_player->thing.layer;
-              prev_player.thing.spawn_frame = main_player->thing.spawn_frame;
-              *main_player = prev_player;
-            }
-            if (l <= MAP_LAYER_BOTTOM_ITEMS && object->thing.type & (TYPE_ITEM | TYPE_GROUND)) {
-              first_collidable = object;
-            }
+    u16 count = map_read_u16(data);
+    data += 2;
+    for (u16 i=0;i<count;++i,data+=MAP_CELL_BYTES) {
+      u16 cell = map_read_u16(data);
+      u16 x = cell % MAP_SIZE, y = cell / MAP_SIZE;
+      u16 gfx = data[2];
+      if (tile_is_static(gfx, l, x, y)) {
+        tile_set(gfx, l, x, y);
+      } else {
+        Object *object = spawn(gfx, l, x * TILE_PIXELS, y * TILE_PIXELS);
+        if (object) {
+          if (object->thing.type == TYPE_PLAYER) {
+            game->main_player_handle = object_handle(object);
+            main_player_resolve();
+            prev_player.thing.id = game->main_player->thing.id;
+            prev_player.thing.gen = game->main_player->thing.gen;
+            prev_player.thing.seq = game->main_player->thing.seq;
+            prev_player.thing.spawn_pos = game->main_player->thing.spawn_pos;
+            prev_player.thing.pos = game->main_player->thing.pos;
+            prev_player.thing.bbox = game->main_player->thing.bbox;
+            prev_player.thing.layer = game->main_player->thing.layer;
+            prev_player.thing.pool = game->main_player->thing.pool;
+            prev_player.thing.spawn_frame = game->main_player->thing.spawn_frame;
+            thing_anim_restart(&prev_player.thing);
+            grid_unlink(&game->main_player->thing);
+            prev_player.thing.indexed = false;
+            *game->main_player = prev_player;
+            grid_link(&game->main_player->thing);
+          }
+          if (l <= MAP_LAYER_BOTTOM_ITEMS && object->thing.type & (TYPE_ITEM | TYPE_GROUND)) {
+            game->first_collidable = object->thing.seq;
           }
         }
       }
     }
   }
-  if (!main_player) {
+#ifdef BENCH_OBJECTS
+  // stress object queries with extra dynamic walls placed in empty cells, out
+  // of reach, they are indexed in the grid like doors
+  static u8 cells[NUM_MAP_LAYERS][MAP_SIZE][MAP_SIZE];
+  map_decode(game->level, cells);
+  for (u32 i=0,n=0;i<MAP_SIZE*MAP_SIZE && n<BENCH_OBJECTS;++i) {
+    u16 x = i % MAP_SIZE, y = i / MAP_SIZE;
+    if (cells[MAP_LAYER_GROUND][y][x] == 0 && cells[MAP_LAYER_WALLS][y][x] == 0) {
+      spawn(GFX_BENCH_WALL, MAP_LAYER_WALLS, x * TILE_PIXELS, y * TILE_PIXELS);
+      n++;
+    }
+  }
+#endif
+  if (!game->main_player) {
     riv_panic("main player not found");
   }
-  riv_printf("LEVEL %d\n", level);
+  state_hash_rebuild();
+  riv_printf("LEVEL %ld\n", game->level);
+}
+
+GameState *game_state_new() {
+  return calloc(1, sizeof(GameState));
+}
+
+void game_state_free(GameState *state) {
+  free(state);
+}
+
+// following calls on this thread simulate the given game
+void game_state_bind(GameState *state) {
+  game = state;
+}
+
+// back to the state of a freshly started game, to run several in one process
+void game_reset() {
+  memset(game->objects, 0, sizeof(game->objects));
+  game->object_count = 0;
+  game->main_player = NULL;
+  game->main_player_handle = (Handle){0, 0};
+  game->level = 0;
+  game->next_level = 0;
+  game->shake_frame = 0;
+  game->shake_offset = (vec2i){0, 0};
+  game->end_frame = 0;
+  game->kills = 0;
+  game->coins = 0;
+  game->hud_valid = false;
+  game->state_hash = 0;
+  game->touched_count = 0;
+#ifdef PROFILE
+  memset(&game->profile, 0, sizeof(game->profile));
+#endif
+}
+
+// Recolored copies of the game spritesheet, made in SPRITESHEET_ID order, so
+// hurt creatures and the gold slime boss draw without palette changes.
+void spritesheets_bake() {
+  for (u32 sps=SPRITESHEET_GAME_HURT;sps<=SPRITESHEET_GAME_GOLD_HURT;++sps) {
+    u8 pal[256];
+    for (u32 i=0;i<256;++i) {
+      pal[i] = i;
+    }
+    if (sps == SPRITESHEET_GAME_HURT || sps == SPRITESHEET_GAME_GOLD_HURT) {
+      pal[0] = RIV_COLOR_RED;
+    }
+    if (sps == SPRITESHEET_GAME_GOLD || sps == SPRITESHEET_GAME_GOLD_HURT) {
+      pal[32] = RIV_COLOR_ORANGE;
+      pal[33] = RIV_COLOR_GOLD;
+      pal[34] = RIV_COLOR_YELLOW;
+      pal[35] = RIV_COLOR_LIGHTYELLOW;
+    }
+    u64 img_id = riv_make_image("simple_dungeon_crawler_16x16.png", 0xff);
+    riv_image *image = &riv->images[img_id];
+    for (u32 i=0;i<image->width*image->height;++i) {
+      image->pixels[i] = pal[image->pixels[i]];
+    }
+    if (riv_make_spritesheet(img_id, TILE_PIXELS, TILE_PIXELS) != sps) {
+      riv_panic("unexpected spritesheet id");
+    }
+  }
 }
 
 void game_init() {
   riv_load_palette("simple_dungeon_crawler_16x16.png", 32);
   riv_make_spritesheet(riv_make_image("simple_dungeon_crawler_16x16.png", 0xff), TILE_PIXELS, TILE_PIXELS);
+#ifndef HEADLESS
+  spritesheets_bake();
+#endif
   load_objects_types();
+  load_levels();
   load_map(0);
 
   // load_map(3);
@@ -1041,12 +2595,12 @@ void game_init() {
 }
 
 void game_update_score() {
-  if (main_player) {
-    i64 frames = end_frame > 0 ? end_frame : riv->frame;
-    i64 health = main_player->creature.health;
-    i64 blade_level = main_player->creature.attack1_damage;
-    i64 bomb_level = maxi(main_player->creature.attack2_damage-1, 0);
-    i64 score = -frames + level*10000 + health*2000 + coins*2000 + (blade_level + bomb_level)*1000 + kills*200;
+  if (game->main_player) {
+    i64 frames = game->end_frame > 0 ? game->end_frame : riv->frame;
+    i64 health = game->main_player->creature.health;
+    i64 blade_level = game->main_player->creature.attack1_damage;
+    i64 bomb_level = maxi(game->main_player->creature.attack2_damage-1, 0);
+    i64 score = -frames + game->level*10000 + health*2000 + game->coins*2000 + (blade_level + bomb_level)*1000 + game->kills*200;
     riv->outcard_len = riv_snprintf((char*)riv->outcard, RIV_SIZE_OUTCARD, "JSON{"
       "\"score\":%ld,"
       "\"frames\":%ld,"
@@ -1057,21 +2611,43 @@ void game_update_score() {
       "\"blade_level\":%ld,"
       "\"bomb_level\":%ld"
     "}\n",
-      score,frames,health,coins,kills,level+1,blade_level,bomb_level);
+      score,frames,health,game->coins,game->kills,game->level+1,blade_level,bomb_level);
+  }
+}
+
+#ifdef PROFILE
+// ends the profiled frame, the level summary is printed once it changes
+void game_profile_frame() {
+  profile_frame_end(&game->profile, game->level);
+}
+
+// prints the summary of the level being played
+void game_profile_report() {
+  profile_report(&game->profile);
+}
+#endif
+
+// rolled while updating, so the random sequence does not depend on drawing
+void shake_update() {
+  game->shake_offset = (vec2i){0, 0};
+  if (game->shake_frame >= riv->frame) {
+    game->shake_offset.x = riv_rand_uint(3);
+    game->shake_offset.y = riv_rand_uint(3);
   }
 }
 
 void game_update() {
+  PROFILE_ZONE(ZONE_GAME_UPDATE);
   game_update_score();
 
-  if (next_level == NUM_LEVELS) {
-    return;
-  }
-  map_update();
+  if (game->next_level != num_levels) {
+    map_update();
 
-  if (next_level != level && next_level < NUM_LEVELS) {
-    load_map(next_level);
+    if (game->next_level != game->level && game->next_level < num_levels) {
+      load_map(game->next_level);
+    }
   }
+  shake_update();
 }
 
 void draw_bordered_text(const char *text, i64 x, i64 y, i64 col) {
@@ -1082,38 +2658,452 @@ void draw_bordered_text(const char *text, i64 x, i64 y, i64 col) {
   riv_draw_text(text, RIV_SPRITESHEET_FONT_5X7, RIV_TOPLEFT, x, y, 1, col);
 }
 
-void game_draw() {
-  map_draw();
-  if (main_player) {
-    i32 secs = (end_frame > 0 ? end_frame : riv->frame) / 60;
-    i32 health = main_player->creature.health;
-    for (i32 i = 0; i < health; ++i) {
+// The HUD is composited once with its outlines into a screen sized layer,
+// then copied over the map every frame. It is composited again only when one
+// of the values it shows changes.
+
+enum {
+  HUD_BANNER_GAME_OVER = 1, // 3 blink phases
+  HUD_BANNER_COMPLETED = 4, // 2 blink phases
+};
+
+HudKey hud_key() {
+  HudKey key = {-1, 0, 0, 0};
+  if (game->main_player) {
+    key.health = game->main_player->creature.health;
+    key.coins = game->coins;
+    key.secs = (game->end_frame > 0 ? game->end_frame : riv->frame) / 60;
+  }
+  if (game->main_player && game->main_player->creature.health == 0) {
+    key.banner = HUD_BANNER_GAME_OVER + (riv->frame / 8) % 3;
+  } else if (game->next_level == num_levels) {
+    key.banner = HUD_BANNER_COMPLETED + (riv->frame / 8) % 2;
+  }
+  return key;
+}
+
+void hud_draw(HudKey key) {
+  if (key.health >= 0) {
+    for (i32 i = 0; i < key.health; ++i) {
       riv_draw_sprite(GFX_ITEM_HEART, SPRITESHEET_GAME, i*13, 4, 1, 1, 1, 1);
     }
     riv_draw_sprite(GFX_ITEM_COIN, SPRITESHEET_GAME, 0, 16, 1, 1, 1, 1);
     riv_draw_sprite(GFX_ITEM_CLOCK, SPRITESHEET_GAME, 256-54, 3, 1, 1, 1, 1);
-    draw_bordered_text(riv_tprintf("%d", coins), 16, 14+8, RIV_COLOR_YELLOW);
-    draw_bordered_text(riv_tprintf("%02d:%02d", secs / 60, secs % 60), 256-36, 8, RIV_COLOR_WHITE);
+    draw_bordered_text(riv_tprintf("%ld", key.coins), 16, 14+8, RIV_COLOR_YELLOW);
+    draw_bordered_text(riv_tprintf("%02ld:%02ld", key.secs / 60, key.secs % 60), 256-36, 8, RIV_COLOR_WHITE);
   }
-  if (main_player && main_player->creature.health == 0) {
+  if (key.banner >= HUD_BANNER_GAME_OVER && key.banner < HUD_BANNER_COMPLETED) {
     riv_draw_text("GAME OVER", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128-24+1, 2, RIV_COLOR_BLACK);
     riv_draw_text("GAME OVER", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128+1, 128-24, 2, RIV_COLOR_BLACK);
-    riv_draw_text("GAME OVER", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128-24, 2, RIV_COLOR_RED + (riv->frame / 8) % 3);
-  } else if (next_level == NUM_LEVELS) {
+    riv_draw_text("GAME OVER", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128-24, 2, RIV_COLOR_RED + key.banner - HUD_BANNER_GAME_OVER);
+  } else if (key.banner >= HUD_BANNER_COMPLETED) {
     riv_draw_text("GAME COMPLETED", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128-24+2, 2, RIV_COLOR_BLACK);
     riv_draw_text("GAME COMPLETED", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128+2, 128-24, 2, RIV_COLOR_BLACK);
-    riv_draw_text("GAME COMPLETED", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128-24, 2, RIV_COLOR_YELLOW + (riv->frame / 8) % 2);
+    riv_draw_text("GAME COMPLETED", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128-24, 2, RIV_COLOR_YELLOW + key.banner - HUD_BANNER_COMPLETED);
     riv_draw_text("  THANKS FOR PLAYING!\n\n      a game by\n edubart and isabella", RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 128+48, 1, RIV_COLOR_YELLOW);
   }
 }
 
+// uses the framebuffer as scratch, so it must be called before drawing a frame
+void hud_build(HudKey key) {
+  PROFILE_ZONE(ZONE_HUD);
+  riv_clear(RIV_COLOR_DARKSLATE);
+  hud_draw(key);
+  memcpy(game->hud_pixels, riv->framebuffer, SCREEN_PIXELS*SCREEN_PIXELS);
+  // pixels not covered by the HUD follow the clear color, compose again over another one to find them
+  riv_clear(RIV_COLOR_BLACK);
+  hud_draw(key);
+  memset(game->hud_opaque, 0, sizeof(game->hud_opaque));
+  i64 x0 = SCREEN_PIXELS, y0 = SCREEN_PIXELS, x1 = 0, y1 = 0;
+  for (i64 y=0;y<SCREEN_PIXELS;++y) {
+    for (i64 x=0;x<SCREEN_PIXELS;++x) {
+      if (game->hud_pixels[y*SCREEN_PIXELS + x] == riv->framebuffer[y*SCREEN_PIXELS + x]) {
+        game->hud_opaque[y][x / 64] |= 1ULL << (x % 64);
+        x0 = mini(x0, x);
+        y0 = mini(y0, y);
+        x1 = maxi(x1, x + 1);
+        y1 = maxi(y1, y + 1);
+      }
+    }
+  }
+  game->hud_rect = (recti){x0, y0, maxi(x1 - x0, 0), maxi(y1 - y0, 0)};
+  game->hud_key = key;
+  game->hud_valid = true;
+}
+
+void hud_blit() {
+  PROFILE_ZONE(ZONE_HUD);
+  recti rect = game->hud_rect;
+  for (i64 y=rect.y;y<rect.y+rect.height;++y) {
+    u8 *src = &game->hud_pixels[y*SCREEN_PIXELS];
+    u8 *dst = &riv->framebuffer[y*SCREEN_PIXELS];
+    for (i64 x=rect.x;x<rect.x+rect.width;++x) {
+      if (game->hud_opaque[y][x / 64] & (1ULL << (x % 64))) {
+        dst[x] = src[x];
+      }
+    }
+  }
+}
+
+void game_draw() {
+  PROFILE_ZONE(ZONE_GAME_DRAW);
+  HudKey key = hud_key();
+#ifndef DEBUG_FULL_REDRAW
+  if (!game->hud_valid || memcmp(&key, &game->hud_key, sizeof(key)) != 0)
+#endif
+  {
+    hud_build(key);
+  }
+  map_draw();
+  hud_blit();
+}
+
+//------------------------------------------------------------------------------
+// Snapshot
+
+// A snapshot holds the whole simulation state in a few KB. Every used object slot
+// is stored as the bytes that differ from its gfx_objects prototype, sparse
+// arrays as the bytes that differ from zero and tiles as the bytes that differ
+// from the level map. Wall masks and render caches are rebuilt on restore.
+
+enum {
+  SNAPSHOT_MAGIC = 0x32534242, // "BBS2"
+};
+
+typedef struct SnapshotHeader {
+  u32 magic;
+  u32 slots; // highest object slot ever used
+  u64 frame;
+  f64 time;
+  u64 quit_frame;
+  u64 rand_state; // riv random state, snapshots are only taken by native builds
+  u32 object_count;
+  u32 free_count;
+  u32 spawn_count;
+  u32 awake_count;
+  u32 first_collidable;
+  Handle main_player_handle;
+  i64 picked_keys;
+  i64 level;
+  i64 next_level;
+  i64 kills;
+  i64 coins;
+  i64 grid_max_size;
+  u64 shake_frame;
+  u64 end_frame;
+  vec2i shake_offset;
+  u32 pool_counts[NUM_POOLS];
+} SnapshotHeader;
+
+typedef struct SnapshotStream {
+  u8 *data;
+  u32 size;
+  u32 pos;
+  bool failed; // ran out of room while writing, or malformed while reading
+} SnapshotStream;
+
+const u16 snapshot_zeros[MAP_SIZE*MAP_SIZE];
+
+void snapshot_write(SnapshotStream *stream, const void *data, u32 size) {
+  if (stream->failed || stream->pos + size > stream->size) {
+    stream->failed = true;
+    return;
+  }
+  memcpy(stream->data + stream->pos, data, size);
+  stream->pos += size;
+}
+
+void snapshot_read(SnapshotStream *stream, void *data, u32 size) {
+  if (stream->failed || stream->pos + size > stream->size) {
+    stream->failed = true;
+    return;
+  }
+  memcpy(data, stream->data + stream->pos, size);
+  stream->pos += size;
+}
+
+// runs of equal bytes are skipped, each run of changed bytes is written as
+// a skip length, a changed length and then the changed bytes
+void snapshot_write_delta(SnapshotStream *stream, const void *data, const void *ref, u32 size) {
+  const u8 *a = data, *b = ref;
+  for (u32 i=0;i<size;) {
+    u8 run[2] = {0, 0};
+    // skip equal words first, most of the data is equal to its reference
+    while (i + 8 <= size && run[0] <= 255-8 && memcmp(a + i, b + i, 8) == 0) {
+      run[0] += 8, i += 8;
+    }
+    while (i < size && a[i] == b[i] && run[0] < 255) {
+      run[0]++, i++;
+    }
+    u32 start = i;
+    while (i < size && a[i] != b[i] && run[1] < 255) {
+      run[1]++, i++;
+    }
+    snapshot_write(stream, run, 2);
+    snapshot_write(stream, a + start, run[1]);
+  }
+}
+
+// data must already hold the reference bytes
+void snapshot_read_delta(SnapshotStream *stream, void *data, u32 size) {
+  u8 *a = data;
+  for (u32 i=0;i<size && !stream->failed;) {
+    u8 run[2] = {0, 0};
+    snapshot_read(stream, run, 2);
+    i += run[0];
+    if (i + run[1] > size) {
+      stream->failed = true;
+      return;
+    }
+    snapshot_read(stream, a + i, run[1]);
+    i += run[1];
+  }
+}
+
+u32 objects_used_slots() {
+  u32 slots = MAX_OBJECTS-1;
+  while (slots > 0 && game->objects[slots].thing.gen == 0) {
+    slots--;
+  }
+  return slots;
+}
+
+// writes the current game into buf, returns its size or 0 when it does not fit.
+// Only native builds can save the random state of riv, elsewhere it returns 0
+// rather than a snapshot whose restored game would roll other random numbers.
+u32 game_snapshot(u8 *buf, u32 size) {
+#ifndef RIV_NATIVE
+  return 0;
+#endif
+  SnapshotStream stream = {buf, size, 0, false};
+  SnapshotHeader header = {
+    .magic = SNAPSHOT_MAGIC,
+    .slots = objects_used_slots(),
+    .frame = riv->frame,
+    .time = riv->time,
+    .quit_frame = riv->quit_frame,
+#ifdef RIV_NATIVE
+    .rand_state = riv_native_get_rand_state(),
+#endif
+    .object_count = game->object_count,
+    .free_count = game->free_count,
+    .spawn_count = game->spawn_count,
+    .awake_count = game->awake_count,
+    .first_collidable = game->first_collidable,
+    .main_player_handle = game->main_player_handle,
+    .picked_keys = game->picked_keys,
+    .level = game->level,
+    .next_level = game->next_level,
+    .kills = game->kills,
+    .coins = game->coins,
+    .grid_max_size = game->grid_max_size,
+    .shake_frame = game->shake_frame,
+    .end_frame = game->end_frame,
+    .shake_offset = game->shake_offset,
+  };
+  memcpy(header.pool_counts, game->pool_counts, sizeof(header.pool_counts));
+  snapshot_write(&stream, &header, sizeof(header));
+  for (u32 i=1;i<=header.slots;++i) {
+    Object *object = &game->objects[i];
+    snapshot_write(&stream, &object->thing.spr, sizeof(u16));
+    snapshot_write_delta(&stream, object, &gfx_objects[object->thing.spr], sizeof(Object));
+  }
+  snapshot_write(&stream, game->free_ids, game->free_count*sizeof(u16));
+  for (u8 pool=0;pool<NUM_POOLS;++pool) {
+    snapshot_write(&stream, game->pools[pool], game->pool_counts[pool]*sizeof(u16));
+  }
+  snapshot_write(&stream, game->awake, game->awake_count*sizeof(u16));
+  snapshot_write_delta(&stream, game->grid_cells, snapshot_zeros, sizeof(game->grid_cells));
+  snapshot_write_delta(&stream, game->sleep_cells, snapshot_zeros, sizeof(game->sleep_cells));
+  u8 level_tiles[NUM_MAP_LAYERS][MAP_SIZE][MAP_SIZE];
+  map_decode(game->level, level_tiles);
+  snapshot_write_delta(&stream, game->tiles, level_tiles, sizeof(game->tiles));
+  return stream.failed ? 0 : stream.pos;
+}
+
+// whether a decoded object only holds ids and indices within the snapshot
+bool snapshot_object_valid(const Object *object, u32 id, const SnapshotHeader *header) {
+  const Thing *thing = &object->thing;
+  if (thing->id != id || thing->spr >= NUM_GFX || thing->anim >= NUM_GFX ||
+      thing->anim_step >= MAX_ANIM_STEPS || thing->layer >= NUM_DRAW_LAYERS || thing->pool >= NUM_POOLS ||
+      thing->cell >= MAP_SIZE*MAP_SIZE || thing->sleep_cell >= MAP_SIZE*MAP_SIZE ||
+      thing->cell_prev > header->slots || thing->cell_next > header->slots || thing->sleep_next > header->slots) {
+    return false;
+  }
+  // the main player handle must resolve to a player
+  return id != header->main_player_handle.id ||
+         (thing->gen == header->main_player_handle.gen && thing->type == TYPE_PLAYER);
+}
+
+bool snapshot_ids_valid(const u16 *ids, u32 count, u16 min_id, u32 max_id) {
+  for (u32 i=0;i<count;++i) {
+    if (ids[i] < min_id || ids[i] > max_id) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// reads the objects, id lists and tiles that follow the header, into the game
+// only when apply is set, so a first pass checks the whole stream before
+// anything changes
+bool snapshot_read_body(const u8 *buf, u32 size, const SnapshotHeader *header, bool apply) {
+  SnapshotStream stream = {(u8*)buf, size, sizeof(SnapshotHeader), false};
+  u16 scratch_ids[MAX_OBJECTS];
+  u16 scratch_cells[MAP_SIZE*MAP_SIZE];
+  u8 scratch_tiles[NUM_MAP_LAYERS][MAP_SIZE][MAP_SIZE];
+  if (apply) {
+    u32 slots = objects_used_slots();
+    if (slots > header->slots) {
+      memset(&game->objects[header->slots+1], 0, (slots - header->slots)*sizeof(Object));
+    }
+  }
+  for (u32 i=1;i<=header->slots;++i) {
+    u16 spr = 0;
+    snapshot_read(&stream, &spr, sizeof(u16));
+    if (stream.failed || spr >= NUM_GFX) {
+      return false;
+    }
+    Object object = gfx_objects[spr];
+    snapshot_read_delta(&stream, &object, sizeof(Object));
+    if (stream.failed || !snapshot_object_valid(&object, i, header)) {
+      return false;
+    }
+    if (apply) {
+      game->objects[i] = object;
+    }
+  }
+  u16 *ids = apply ? game->free_ids : scratch_ids;
+  snapshot_read(&stream, ids, header->free_count*sizeof(u16));
+  if (stream.failed || !snapshot_ids_valid(ids, header->free_count, 1, header->object_count)) {
+    return false;
+  }
+  for (u8 pool=0;pool<NUM_POOLS;++pool) {
+    ids = apply ? game->pools[pool] : scratch_ids;
+    snapshot_read(&stream, ids, header->pool_counts[pool]*sizeof(u16));
+    if (stream.failed || !snapshot_ids_valid(ids, header->pool_counts[pool], 1, header->object_count)) {
+      return false;
+    }
+  }
+  ids = apply ? game->awake : scratch_ids;
+  snapshot_read(&stream, ids, header->awake_count*sizeof(u16));
+  if (stream.failed || !snapshot_ids_valid(ids, header->awake_count, 1, header->object_count)) {
+    return false;
+  }
+  u16 *cells = apply ? game->grid_cells : scratch_cells;
+  memset(cells, 0, sizeof(scratch_cells));
+  snapshot_read_delta(&stream, cells, sizeof(scratch_cells));
+  if (stream.failed || !snapshot_ids_valid(cells, MAP_SIZE*MAP_SIZE, 0, header->slots)) {
+    return false;
+  }
+  cells = apply ? game->sleep_cells : scratch_cells;
+  memset(cells, 0, sizeof(scratch_cells));
+  snapshot_read_delta(&stream, cells, sizeof(scratch_cells));
+  if (stream.failed || !snapshot_ids_valid(cells, MAP_SIZE*MAP_SIZE, 0, header->slots)) {
+    return false;
+  }
+  u8 (*tiles)[MAP_SIZE][MAP_SIZE] = apply ? game->tiles : scratch_tiles;
+  map_decode(header->level, tiles);
+  snapshot_read_delta(&stream, tiles, sizeof(scratch_tiles));
+  return !stream.failed;
+}
+
+// replaces the current game with a snapshot, returns false when it is
+// malformed, the game is then left untouched
+bool game_restore(const u8 *buf, u32 size) {
+  SnapshotStream stream = {(u8*)buf, size, 0, false};
+  SnapshotHeader header;
+  snapshot_read(&stream, &header, sizeof(header));
+  if (stream.failed || header.magic != SNAPSHOT_MAGIC || header.slots >= MAX_OBJECTS ||
+      header.object_count > header.slots || header.free_count > header.object_count ||
+      header.awake_count > header.object_count || header.main_player_handle.id > header.slots ||
+      header.level < 0 || header.level >= num_levels || header.next_level < 0 || header.next_level > num_levels) {
+    return false;
+  }
+  for (u8 pool=0;pool<NUM_POOLS;++pool) {
+    if (header.pool_counts[pool] > header.object_count) {
+      return false;
+    }
+  }
+  if (!snapshot_read_body(buf, size, &header, false)) {
+    return false;
+  }
+  snapshot_read_body(buf, size, &header, true);
+
+  riv->frame = header.frame;
+  riv->time = header.time;
+  riv->quit_frame = header.quit_frame;
+#ifdef RIV_NATIVE
+  riv_native_set_rand_state(header.rand_state);
+#endif
+  game->object_count = header.object_count;
+  game->free_count = header.free_count;
+  game->spawn_count = header.spawn_count;
+  game->awake_count = header.awake_count;
+  game->first_collidable = header.first_collidable;
+  game->main_player_handle = header.main_player_handle;
+  game->picked_keys = header.picked_keys;
+  game->level = header.level;
+  game->next_level = header.next_level;
+  game->kills = header.kills;
+  game->coins = header.coins;
+  game->grid_max_size = header.grid_max_size;
+  game->shake_frame = header.shake_frame;
+  game->end_frame = header.end_frame;
+  game->shake_offset = header.shake_offset;
+  memcpy(game->pool_counts, header.pool_counts, sizeof(game->pool_counts));
+  if (game->main_player_handle.id == 0) {
+    game->main_player = NULL;
+  } else {
+    main_player_resolve(); // checked while reading the objects
+  }
+  state_hash_rebuild();
+
+  // static walls never change once placed, so the wall mask follows from the
+  // wall tiles and objects, only the walls layer can hold static wall tiles
+  wall_mask_clear();
+  memset(game->chunk_dirty, 1, sizeof(game->chunk_dirty));
+  game->hud_valid = false;
+  for (u16 y=0;y<MAP_SIZE;++y) {
+    for (u16 x=0;x<MAP_SIZE;++x) {
+      u16 gfx = game->tiles[MAP_LAYER_WALLS][y][x];
+      if (gfx != 0) {
+        Object object = tile_object(gfx, MAP_LAYER_WALLS, x, y);
+        if (thing_is_static_wall(&object.thing)) {
+          wall_mask_fill(object.thing.bbox);
+        }
+      }
+    }
+  }
+  for (u32 i=1;i<=game->object_count;++i) {
+    Thing *thing = &game->objects[i].thing;
+    if (!thing->removed && thing_is_static_wall(thing)) {
+      wall_mask_fill(thing->bbox);
+    }
+  }
+  return true;
+}
+
 //------------------------------------------------------------------------------
 // Main
 
+#ifndef NO_MAIN
 int main() {
   game_init();
   do {
     game_update();
+#ifdef STATE_TRACE
+    riv_printf("frame %lu digest %016lx\n", riv->frame, game_digest());
+#endif
+#ifndef HEADLESS
     game_draw();
+#endif
+#ifdef PROFILE
+    game_profile_frame();
+#endif
   } while(riv_present());
+#ifdef PROFILE
+  game_profile_report();
+#endif
 }
+#endif
@@ -34,6 +34,7 @@
       .thing = {
         .type = TYPE_WALL,
         .spr = GFX_WALL_AUTO_DOOR,
+        .dynamic = true,
         .spr_bbox = {0, 9, 32, 23},
         .spr_tiles = {2, 2},
         .spr_frames = 11,
@@ -47,6 +48,7 @@
       .thing = {
         .type = TYPE_WALL,
         .spr = GFX_WALL_CLOSED_DOOR,
+        .dynamic = true,
         .spr_bbox = {0, 9, 32, 23},
         .spr_tiles = {2, 2},
         .spr_frames = 14,
@@ -88,6 +90,7 @@
     .item = {
       .thing.type = TYPE_WALL,
       .thing.spr = GFX_ITEM_CHEST,
+      .thing.dynamic = true,
       .thing.spr_frames = 8,
       .thing.spr_frame_duration = 6,
       .thing.spr_loop_delay = 12,
@@ -190,4 +193,12 @@
       .thing.spr_frame_duration = 4,
     },
   },
+  // bench
+  [GFX_BENCH_WALL] = { // dynamic copy of a plain wall, so BENCH_OBJECTS fills the spatial index
+    .thing = {
+      .type = TYPE_WALL,
+      .spr = 60,
+      .dynamic = true,
+    },
+  },
 };
@@ -1,27 +1,22 @@
-local function conv_map(map, f, level)
-  f:write('{ // level ',level,'\n')
-  for l,layer in ipairs(map.layers) do
-    f:write('  { // layer ',l-1,'\n')
+-- Converts the Tiled maps to ../level<n>.bin files, stored sparse since most
+-- cells are empty. Each level file holds its layers in order, a layer is a u16
+-- count of non-empty cells followed by that many cells as a u16 y*width+x index
+-- and a u8 gfx, in row order, all little endian.
+
+local function conv_map(map, level)
+  local f <close> = io.open('../level'..level..'.bin', 'wb')
+  for _,layer in ipairs(map.layers) do
+    local cells = {}
     for i,spr in ipairs(layer.data) do
-      local y = (i-1) // map.width
-      local x = (i-1) % map.width
-      if x == 0 then f:write('    {') end
-      f:write(string.format("%3d", math.max(spr-1,0)))
-      if x == map.width-1 then
-        f:write('},\n')
-      else
-        f:write(',')
+      if spr > 1 then
+        cells[#cells+1] = string.pack('<I2B', i-1, spr-1)
       end
     end
-    f:write('  },\n')
+    f:write(string.pack('<I2', #cells), table.concat(cells))
   end
-  f:write('},')
 end
 
-local f <close> = io.open('../maps.h', 'w')
-f:write('{\n')
-conv_map(require 'l1', f, 1)
-conv_map(require 'l2', f, 2)
-conv_map(require 'l3', f, 3)
-conv_map(require 'l4', f, 4)
-f:write('};\n')
+conv_map(require 'l1', 1)
+conv_map(require 'l2', 2)
+conv_map(require 'l3', 3)
+conv_map(require 'l4', 4)
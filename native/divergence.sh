@@ -0,0 +1,36 @@
+#!/bin/sh
+# Replays one tape through two builds of bladebomber-replay, for example a
+# reference build and an optimized one, and reports the first frame whose
+# state digest differs together with the object fields that differ there.
+# Both sides must be native builds, a rivemu run cannot be compared since the
+# native random numbers differ from riv's.
+# usage: native/divergence.sh <replay-a> <replay-b> <tape>
+set -e
+a=$1
+b=$2
+tape=$3
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+"$a" -t "$tape" 2>/dev/null | grep '^frame' > "$tmp/a.trace"
+"$b" -t "$tape" 2>/dev/null | grep '^frame' > "$tmp/b.trace"
+frame=$(diff "$tmp/a.trace" "$tmp/b.trace" | awk '/^[<>] frame/ {print $3; exit}')
+if [ -z "$frame" ]; then
+  echo "same state on all $(wc -l < "$tmp/a.trace") frames"
+  exit 0
+fi
+echo "first divergent frame: $frame"
+
+"$a" -d "$frame" "$tape" 2>&1 >/dev/null | grep '^game\|^object' > "$tmp/a.dump"
+"$b" -d "$frame" "$tape" 2>&1 >/dev/null | grep '^game\|^object' > "$tmp/b.dump"
+# field by field, keyed by the object slot
+awk 'NR == FNR { a[$1 " " $2] = $0; next }
+     {
+       key = $1 " " $2
+       if (a[key] == $0) next
+       na = split(a[key], fa, " ")
+       nb = split($0, fb, " ")
+       for (i = 3; i <= (na > nb ? na : nb); ++i)
+         if (fa[i] != fb[i]) printf "%s: %s -> %s\n", key, fa[i], fb[i]
+     }' "$tmp/a.dump" "$tmp/b.dump"
+exit 1
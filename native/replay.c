@@ -0,0 +1,240 @@
+// Batch tape replayer: runs every tape of a directory in one process, one
+// game per thread, and writes the outcard of each one, reporting tapes/sec
+// and frames/sec.
+// A tape holds one byte per frame, bit i set when key i is down, in
+// riv_key_code order (up, down, left, right, a1, a2, a3, a4).
+// Usage: bladebomber-replay [-j threads] [-t] [-d frame] <tapes-dir|tape> [outcards-dir]
+// Without an outcards dir each outcard is printed after its tape name.
+// -t prints the state digest of every frame and -d dumps the state fields of
+// one frame, both run on a single thread, see divergence.sh.
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "riv.h"
+
+typedef struct GameState GameState;
+GameState *game_state_new(void);
+void game_state_free(GameState *state);
+void game_state_bind(GameState *state);
+void load_objects_types(void);
+void load_levels(void);
+void game_reset(void);
+void game_init(void);
+void game_update(void);
+uint64_t game_digest(void);
+void game_dump(void);
+#ifdef PROFILE
+void game_profile_frame(void);
+void game_profile_report(void);
+#endif
+
+typedef struct Result {
+  char *outcard;
+  uint32_t outcard_len;
+  uint64_t frames;
+} Result;
+
+static const char *tapes_dir;
+static char **names;
+static size_t num_names;
+static Result *results;
+static atomic_size_t next_tape;
+static uint64_t replay_seed;
+static bool trace_digests;
+static int64_t dump_frame = -1;
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t *read_tape(const char *path, uint64_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(size > 0 ? size : 1);
+  *len = fread(data, 1, size > 0 ? size : 0, f);
+  fclose(f);
+  return data;
+}
+
+// simulates a whole tape from a fresh game, returns the number of frames run
+static uint64_t replay_tape(const uint8_t *tape, uint64_t len, uint64_t seed) {
+  riv_native_reset(seed);
+  game_reset();
+  game_init();
+  for (uint64_t i=0;i<len;++i) {
+    for (uint32_t key=0;key<RIV_NUM_KEYCODE;++key) {
+      bool down = (tape[i] >> key) & 1;
+      riv->keys[key].press = down && !riv->keys[key].down;
+      riv->keys[key].release = !down && riv->keys[key].down;
+      riv->keys[key].down = down;
+    }
+    game_update();
+    if (trace_digests) {
+      printf("frame %lu digest %016lx\n", (unsigned long)riv->frame, (unsigned long)game_digest());
+    }
+    if ((int64_t)riv->frame == dump_frame) {
+      game_dump();
+    }
+#ifdef PROFILE
+    game_profile_frame();
+#endif
+    riv->frame++;
+    riv->time = riv->frame / 60.0;
+    if (riv->quit_frame > 0 && riv->frame >= riv->quit_frame) {
+      break;
+    }
+  }
+#ifdef PROFILE
+  game_profile_report();
+#endif
+  return riv->frame;
+}
+
+// takes tapes until none is left, each thread owns its riv context and game
+static void *replay_worker(void *arg) {
+  (void)arg;
+  riv = calloc(1, sizeof(riv_context));
+  GameState *state = game_state_new();
+  game_state_bind(state);
+  char path[4096];
+  for (size_t i; (i = atomic_fetch_add(&next_tape, 1)) < num_names;) {
+    snprintf(path, sizeof(path), "%s/%s", tapes_dir, names[i]);
+    uint64_t len;
+    uint8_t *tape = read_tape(path, &len);
+    if (!tape) {
+      fprintf(stderr, "cannot read %s\n", path);
+      continue;
+    }
+    results[i].frames = replay_tape(tape, len, replay_seed);
+    results[i].outcard_len = riv->outcard_len;
+    results[i].outcard = malloc(riv->outcard_len + 1);
+    memcpy(results[i].outcard, riv->outcard, riv->outcard_len);
+    free(tape);
+  }
+  game_state_free(state);
+  free(riv);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  for (;;) {
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+      num_threads = atol(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if (argc > 2 && strcmp(argv[1], "-d") == 0) {
+      dump_frame = atoll(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if (argc > 1 && strcmp(argv[1], "-t") == 0) {
+      trace_digests = true;
+      argc -= 1;
+      argv += 1;
+    } else {
+      break;
+    }
+  }
+  if (argc < 2 || num_threads < 1) {
+    fprintf(stderr, "usage: bladebomber-replay [-j threads] [-t] [-d frame] <tapes-dir|tape> [outcards-dir]\n");
+    return 1;
+  }
+  if (trace_digests || dump_frame >= 0) { // keep the output of each tape together
+    num_threads = 1;
+  }
+  tapes_dir = argv[1];
+  const char *outcards_dir = argc > 2 ? argv[2] : NULL;
+  const char *seed_env = getenv("RIV_SEED");
+  replay_seed = seed_env ? strtoull(seed_env, NULL, 10) : 0;
+
+  DIR *dir = opendir(tapes_dir);
+  if (dir) {
+    size_t cap_names = 0;
+    for (struct dirent *entry; (entry = readdir(dir));) {
+      if (entry->d_name[0] == '.') {
+        continue;
+      }
+      if (num_names == cap_names) {
+        cap_names = cap_names ? cap_names*2 : 64;
+        names = realloc(names, cap_names * sizeof(char *));
+      }
+      names[num_names++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, num_names, sizeof(char *), compare_names);
+  } else { // a single tape
+    char *slash = strrchr(argv[1], '/');
+    names = malloc(sizeof(char *));
+    names[num_names++] = strdup(slash ? slash + 1 : argv[1]);
+    if (slash) {
+      *slash = 0;
+    } else {
+      tapes_dir = ".";
+    }
+  }
+
+  results = calloc(num_names + 1, sizeof(Result));
+  // prototypes and levels are shared by every game, fill them before any
+  // thread reads them
+  load_objects_types();
+  load_levels();
+
+  double start = now();
+  pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+  for (long t=0;t<num_threads;++t) {
+    pthread_create(&threads[t], NULL, replay_worker, NULL);
+  }
+  for (long t=0;t<num_threads;++t) {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+
+  uint64_t num_tapes = 0, num_frames = 0;
+  char path[4096];
+  for (size_t i=0;i<num_names;++i) {
+    if (!results[i].outcard) {
+      continue;
+    }
+    num_tapes++;
+    num_frames += results[i].frames;
+    if (outcards_dir) {
+      snprintf(path, sizeof(path), "%s/%s.outcard", outcards_dir, names[i]);
+      FILE *f = fopen(path, "wb");
+      if (!f) {
+        fprintf(stderr, "cannot write %s\n", path);
+        continue;
+      }
+      fwrite(results[i].outcard, 1, results[i].outcard_len, f);
+      fclose(f);
+    } else {
+      printf("%s: %.*s", names[i], (int)results[i].outcard_len, results[i].outcard);
+    }
+  }
+  double elapsed = now() - start;
+  fprintf(stderr, "%lu tapes, %lu frames in %.3fs with %ld threads: %.1f tapes/sec, %.0f frames/sec\n",
+    (unsigned long)num_tapes, (unsigned long)num_frames, elapsed, num_threads,
+    num_tapes / elapsed, num_frames / elapsed);
+  for (size_t i=0;i<num_names;++i) {
+    free(results[i].outcard);
+    free(names[i]);
+  }
+  free(results);
+  free(names);
+  return 0;
+}
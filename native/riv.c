@@ -0,0 +1,188 @@
+// Native implementation of the riv.h stand-in: frame loop, keys, random,
+// outcard and sprite bounding boxes; drawing and sound do nothing.
+// Environment variables:
+//   RIV_SEED        random seed (default 0)
+//   RIV_STOP_FRAME  stop after this many frames (default 0, never)
+//   RIV_OUTCARD     file to write the outcard to (default stdout)
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "riv.h"
+#include "sprite_bboxes.h"
+
+enum {
+  SPRITE_PIXELS = 16,
+  SPRITE_COLUMNS = 16,
+  NUM_SPRITES = sizeof(sprite_bboxes) / sizeof(sprite_bboxes[0]),
+};
+
+static riv_context context;
+static uint8_t framebuffer[256*256];
+static _Thread_local uint64_t rand_state;
+static uint64_t stop_frame;
+
+_Thread_local riv_context *riv = &context;
+
+static uint64_t env_u64(const char *name, uint64_t def) {
+  const char *s = getenv(name);
+  return s ? strtoull(s, NULL, 10) : def;
+}
+
+void riv_native_reset(uint64_t seed) {
+  memset(riv, 0, sizeof(*riv));
+  riv->framebuffer = framebuffer;
+  rand_state = seed * 0x9E3779B97F4A7C15ull + 0x2545F4914F6CDD1Dull;
+}
+
+__attribute__((constructor)) static void riv_init(void) {
+  riv_native_reset(env_u64("RIV_SEED", 0));
+  stop_frame = env_u64("RIV_STOP_FRAME", 0);
+}
+
+static void write_outcard(void) {
+  const char *path = getenv("RIV_OUTCARD");
+  FILE *f = path ? fopen(path, "wb") : stdout;
+  if (!f) {
+    riv_panic("failed to open outcard file");
+  }
+  fwrite(riv->outcard, 1, riv->outcard_len, f);
+  if (f != stdout) {
+    fclose(f);
+  }
+}
+
+bool riv_present(void) {
+  riv->frame++;
+  riv->time = riv->frame / 60.0;
+  if ((riv->quit_frame > 0 && riv->frame >= riv->quit_frame) || (stop_frame > 0 && riv->frame >= stop_frame)) {
+    write_outcard();
+    return false;
+  }
+  return true;
+}
+
+void riv_panic(const char *msg) {
+  fprintf(stderr, "PANIC: %s\n", msg);
+  exit(1);
+}
+
+//------------------------------------------------------------------------------
+// Random
+
+static uint64_t rand_next(void) {
+  // xorshift64*
+  rand_state ^= rand_state >> 12;
+  rand_state ^= rand_state << 25;
+  rand_state ^= rand_state >> 27;
+  return rand_state * 0x2545F4914F6CDD1Dull;
+}
+
+uint64_t riv_native_get_rand_state(void) {
+  return rand_state;
+}
+
+void riv_native_set_rand_state(uint64_t state) {
+  rand_state = state;
+}
+
+uint64_t riv_rand_uint(uint64_t high) {
+  return high == UINT64_MAX ? rand_next() : rand_next() % (high + 1);
+}
+
+double riv_rand_float(void) {
+  return (rand_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//------------------------------------------------------------------------------
+// Text
+
+char *riv_tprintf(const char *fmt, ...) {
+  static _Thread_local char bufs[8][256];
+  static _Thread_local uint32_t next;
+  char *buf = bufs[next++ % 8];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(bufs[0]), fmt, args);
+  va_end(args);
+  return buf;
+}
+
+//------------------------------------------------------------------------------
+// Images
+
+void riv_load_palette(const char *filename, int64_t start) {
+  (void)filename; (void)start;
+}
+
+// images are not decoded, they only take an id like in rivemu, starting at 1
+uint64_t riv_make_image(const char *filename, int64_t color_key) {
+  (void)filename;
+  for (uint64_t id=1;id<RIV_MAX_IMAGES;++id) {
+    if (!riv->images[id].owned) {
+      riv->images[id] = (riv_image){NULL, 0, 0, color_key, true};
+      return id;
+    }
+  }
+  riv_panic("out of images");
+  return 0;
+}
+
+uint64_t riv_make_spritesheet(uint64_t img_id, uint32_t cell_width, uint32_t cell_height) {
+  for (uint64_t id=1;id<RIV_MAX_SPRITESHEETS;++id) {
+    if (riv->spritesheets[id].cell_width == 0) {
+      riv->spritesheets[id] = (riv_spritesheet){img_id, cell_width, cell_height};
+      return id;
+    }
+  }
+  riv_panic("out of spritesheets");
+  return 0;
+}
+
+// union of the opaque boxes of the nx*ny cells starting at sprite n
+riv_recti riv_get_sprite_bbox(uint32_t n, uint64_t sps_id, int64_t nx, int64_t ny) {
+  (void)sps_id;
+  int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+  for (int64_t ty=0;ty<ny;++ty) {
+    for (int64_t tx=0;tx<nx;++tx) {
+      uint64_t cell = n + ty*SPRITE_COLUMNS + tx;
+      if (cell >= NUM_SPRITES || sprite_bboxes[cell][2] == 0) {
+        continue;
+      }
+      const unsigned char *box = sprite_bboxes[cell];
+      int64_t bx = tx*SPRITE_PIXELS + box[0], by = ty*SPRITE_PIXELS + box[1];
+      x0 = bx < x0 ? bx : x0;
+      y0 = by < y0 ? by : y0;
+      x1 = bx + box[2] > x1 ? bx + box[2] : x1;
+      y1 = by + box[3] > y1 ? by + box[3] : y1;
+    }
+  }
+  if (x0 > x1) {
+    return (riv_recti){0, 0, 0, 0};
+  }
+  return (riv_recti){x0, y0, x1 - x0, y1 - y0};
+}
+
+//------------------------------------------------------------------------------
+// Drawing and sound
+
+void riv_clear(uint32_t col) {
+  memset(framebuffer, (uint8_t)col, sizeof(framebuffer));
+}
+
+void riv_draw_sprite(uint32_t n, uint64_t sps_id, int64_t x0, int64_t y0, int64_t nx, int64_t ny, int64_t mx, int64_t my) {
+  (void)n; (void)sps_id; (void)x0; (void)y0; (void)nx; (void)ny; (void)mx; (void)my;
+}
+
+void riv_draw_rect_line(int64_t x0, int64_t y0, int64_t w, int64_t h, uint32_t col) {
+  (void)x0; (void)y0; (void)w; (void)h; (void)col;
+}
+
+riv_vec2i riv_draw_text(const char *text, uint64_t sps_id, riv_align anchor, int64_t x, int64_t y, int64_t size, int64_t col) {
+  (void)text; (void)sps_id; (void)anchor; (void)x; (void)y; (void)size; (void)col;
+  return (riv_vec2i){0, 0};
+}
+
+uint64_t riv_waveform(riv_waveform_desc *desc) {
+  (void)desc;
+  return 0;
+}
@@ -0,0 +1,192 @@
+// Minimal stand-in for the parts of riv.h the game uses, so it can be
+// compiled and run natively on the host (see `make native`).
+// Drawing and sound are no-ops, the simulation is the same as in rivemu.
+#ifndef RIV_H
+#define RIV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct riv_vec2i { int64_t x, y; } riv_vec2i;
+typedef struct riv_vec2f { float x, y; } riv_vec2f;
+typedef struct riv_recti { int64_t x, y, width, height; } riv_recti;
+
+enum {
+  RIV_SIZE_OUTCARD = 256*1024,
+};
+
+typedef enum riv_key_code {
+  RIV_GAMEPAD_UP = 0,
+  RIV_GAMEPAD_DOWN,
+  RIV_GAMEPAD_LEFT,
+  RIV_GAMEPAD_RIGHT,
+  RIV_GAMEPAD_A1,
+  RIV_GAMEPAD_A2,
+  RIV_GAMEPAD_A3,
+  RIV_GAMEPAD_A4,
+  RIV_NUM_KEYCODE,
+} riv_key_code;
+
+typedef enum riv_waveform_type {
+  RIV_WAVEFORM_NONE = 0,
+  RIV_WAVEFORM_SINE,
+  RIV_WAVEFORM_SQUARE,
+  RIV_WAVEFORM_TRIANGLE,
+  RIV_WAVEFORM_SAWTOOTH,
+  RIV_WAVEFORM_NOISE,
+  RIV_WAVEFORM_PULSE,
+} riv_waveform_type;
+
+typedef struct riv_waveform_desc {
+  uint64_t id;
+  riv_waveform_type type;
+  float delay, attack, decay, sustain, release;
+  float start_frequency, end_frequency;
+  float amplitude, sustain_level, duty_cycle, pan;
+} riv_waveform_desc;
+
+enum {
+  RIV_COLOR_BLACK = 0,
+  RIV_COLOR_DARKBLUE,
+  RIV_COLOR_DARKPURPLE,
+  RIV_COLOR_DARKGREEN,
+  RIV_COLOR_BROWN,
+  RIV_COLOR_DARKGREY,
+  RIV_COLOR_LIGHTGREY,
+  RIV_COLOR_WHITE,
+  RIV_COLOR_RED,
+  RIV_COLOR_ORANGE,
+  RIV_COLOR_YELLOW,
+  RIV_COLOR_GREEN,
+  RIV_COLOR_BLUE,
+  RIV_COLOR_LAVENDER,
+  RIV_COLOR_PINK,
+  RIV_COLOR_LIGHTPEACH,
+  RIV_COLOR_DARKSLATE,
+  RIV_COLOR_GOLD,
+  RIV_COLOR_LIGHTYELLOW,
+  RIV_COLOR_LIGHTGREEN,
+};
+
+enum {
+  RIV_SPRITESHEET_FONT_3X5 = 0,
+  RIV_SPRITESHEET_FONT_5X7 = 1,
+};
+
+typedef enum riv_align {
+  RIV_TOPLEFT = 0,
+  RIV_CENTER = 4,
+} riv_align;
+
+typedef struct riv_key_state {
+  bool down, press, release;
+} riv_key_state;
+
+typedef struct riv_draw_state {
+  riv_vec2i origin;
+  bool color_key_disabled;
+  bool pal_enabled;
+  uint8_t pal[256];
+} riv_draw_state;
+
+enum {
+  RIV_MAX_IMAGES = 16,
+  RIV_MAX_SPRITESHEETS = 16,
+};
+
+typedef struct riv_image {
+  uint8_t *pixels; // palette indices, none in the native build
+  uint32_t width;
+  uint32_t height;
+  int64_t color_key;
+  bool owned;
+} riv_image;
+
+typedef struct riv_spritesheet {
+  uint64_t image_id;
+  uint32_t cell_width;
+  uint32_t cell_height;
+} riv_spritesheet;
+
+typedef struct riv_context {
+  uint64_t frame;
+  double time;
+  uint64_t quit_frame;
+  uint8_t *framebuffer;
+  riv_key_state keys[RIV_NUM_KEYCODE];
+  riv_draw_state draw;
+  uint8_t outcard[RIV_SIZE_OUTCARD];
+  uint32_t outcard_len;
+  riv_image images[RIV_MAX_IMAGES];
+  riv_spritesheet spritesheets[RIV_MAX_SPRITESHEETS];
+} riv_context;
+
+extern _Thread_local riv_context *riv; // each simulation thread binds its own context
+
+bool riv_present(void);
+void riv_panic(const char *msg);
+
+// native only extensions
+#define RIV_NATIVE
+void riv_native_reset(uint64_t seed); // restart the current context at frame 0
+uint64_t riv_native_get_rand_state(void);
+void riv_native_set_rand_state(uint64_t state);
+
+uint64_t riv_rand_uint(uint64_t high);
+double riv_rand_float(void);
+
+#define riv_printf(...) fprintf(stderr, __VA_ARGS__)
+#define riv_snprintf snprintf
+char *riv_tprintf(const char *fmt, ...);
+
+void riv_load_palette(const char *filename, int64_t start);
+uint64_t riv_make_image(const char *filename, int64_t color_key);
+uint64_t riv_make_spritesheet(uint64_t img_id, uint32_t cell_width, uint32_t cell_height);
+riv_recti riv_get_sprite_bbox(uint32_t n, uint64_t sps_id, int64_t nx, int64_t ny);
+
+void riv_clear(uint32_t col);
+void riv_draw_sprite(uint32_t n, uint64_t sps_id, int64_t x0, int64_t y0, int64_t nx, int64_t ny, int64_t mx, int64_t my);
+void riv_draw_rect_line(int64_t x0, int64_t y0, int64_t w, int64_t h, uint32_t col);
+riv_vec2i riv_draw_text(const char *text, uint64_t sps_id, riv_align anchor, int64_t x, int64_t y, int64_t size, int64_t col);
+
+uint64_t riv_waveform(riv_waveform_desc *desc);
+
+#define RIV_NOTE_C4 261.63f
+#define RIV_NOTE_Cs4 277.18f
+#define RIV_NOTE_D4 293.66f
+#define RIV_NOTE_Ds4 311.13f
+#define RIV_NOTE_E4 329.63f
+#define RIV_NOTE_F4 349.23f
+#define RIV_NOTE_Fs4 369.99f
+#define RIV_NOTE_G4 392.00f
+#define RIV_NOTE_Gs4 415.30f
+#define RIV_NOTE_A4 440.00f
+#define RIV_NOTE_As4 466.16f
+#define RIV_NOTE_B4 493.88f
+#define RIV_NOTE_C5 523.25f
+#define RIV_NOTE_Cs5 554.37f
+#define RIV_NOTE_D5 587.33f
+#define RIV_NOTE_Ds5 622.25f
+#define RIV_NOTE_E5 659.26f
+#define RIV_NOTE_F5 698.46f
+#define RIV_NOTE_Fs5 739.99f
+#define RIV_NOTE_G5 783.99f
+#define RIV_NOTE_Gs5 830.61f
+#define RIV_NOTE_A5 880.00f
+#define RIV_NOTE_As5 932.33f
+#define RIV_NOTE_B5 987.77f
+#define RIV_NOTE_C6 1046.50f
+#define RIV_NOTE_Cs6 1108.73f
+#define RIV_NOTE_D6 1174.66f
+#define RIV_NOTE_Ds6 1244.51f
+#define RIV_NOTE_E6 1318.51f
+#define RIV_NOTE_F6 1396.91f
+#define RIV_NOTE_Fs6 1479.98f
+#define RIV_NOTE_G6 1567.98f
+#define RIV_NOTE_Gs6 1661.22f
+#define RIV_NOTE_A6 1760.00f
+#define RIV_NOTE_As6 1864.66f
+#define RIV_NOTE_B6 1975.53f
+
+#endif
@@ -0,0 +1,259 @@
+// generated by sprite_bboxes.py, do not edit
+static const unsigned char sprite_bboxes[][4] = {
+  {0, 0, 0, 0},
+  {1, 6, 12, 7},
+  {0, 0, 16, 16},
+  {1, 0, 14, 15},
+  {1, 0, 14, 15},
+  {1, 4, 15, 9},
+  {4, 2, 7, 10},
+  {4, 2, 7, 10},
+  {4, 2, 7, 10},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 0, 0},
+  {0, 9, 3, 7},
+  {13, 9, 3, 7},
+  {0, 0, 0, 0},
+  {0, 0, 16, 15},
+  {0, 0, 16, 15},
+  {3, 1, 11, 14},
+  {0, 0, 0, 0},
+  {1, 0, 14, 16},
+  {0, 0, 16, 15},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 0, 0},
+  {0, 0, 4, 16},
+  {12, 0, 4, 16},
+  {0, 0, 0, 0},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {1, 1, 15, 15},
+  {0, 0, 0, 0},
+  {0, 9, 16, 7},
+  {0, 9, 16, 7},
+  {0, 0, 4, 16},
+  {12, 0, 4, 16},
+  {0, 9, 16, 7},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {1, 1, 14, 14},
+  {2, 2, 12, 11},
+  {0, 0, 16, 16},
+  {0, 8, 16, 8},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 0, 16, 16},
+  {2, 1, 13, 13},
+  {2, 1, 13, 13},
+  {2, 2, 13, 12},
+  {2, 2, 13, 12},
+  {2, 1, 13, 13},
+  {2, 1, 13, 13},
+  {3, 4, 10, 9},
+  {2, 5, 12, 8},
+  {3, 5, 10, 9},
+  {2, 6, 12, 7},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {2, 1, 13, 13},
+  {2, 0, 13, 12},
+  {2, 1, 13, 12},
+  {2, 1, 13, 13},
+  {2, 0, 13, 12},
+  {2, 1, 13, 13},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 0, 0},
+  {0, 3, 16, 12},
+  {0, 3, 16, 12},
+  {0, 3, 16, 12},
+  {0, 3, 16, 12},
+  {0, 4, 16, 11},
+  {0, 4, 16, 11},
+  {4, 3, 8, 11},
+  {4, 1, 9, 13},
+  {4, 2, 9, 12},
+  {4, 2, 9, 12},
+  {4, 2, 9, 12},
+  {3, 2, 10, 12},
+  {4, 2, 10, 12},
+  {3, 2, 10, 12},
+  {4, 3, 8, 11},
+  {3, 5, 10, 9},
+  {0, 3, 16, 12},
+  {0, 3, 16, 12},
+  {0, 5, 16, 10},
+  {0, 5, 16, 10},
+  {0, 4, 16, 11},
+  {0, 4, 16, 11},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {3, 1, 10, 14},
+  {3, 1, 10, 14},
+  {3, 2, 10, 13},
+  {3, 2, 10, 13},
+  {3, 1, 10, 14},
+  {3, 1, 10, 14},
+  {1, 3, 11, 10},
+  {0, 2, 13, 13},
+  {0, 2, 13, 13},
+  {0, 2, 13, 13},
+  {0, 0, 0, 0},
+  {3, 9, 12, 6},
+  {0, 8, 8, 8},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {2, 1, 11, 14},
+  {2, 0, 12, 13},
+  {2, 1, 11, 13},
+  {2, 1, 11, 14},
+  {2, 0, 11, 13},
+  {2, 1, 11, 14},
+  {6, 4, 4, 8},
+  {6, 3, 4, 9},
+  {6, 5, 4, 7},
+  {6, 4, 4, 8},
+  {6, 3, 4, 9},
+  {6, 5, 4, 7},
+  {0, 0, 11, 16},
+  {0, 0, 11, 16},
+  {9, 3, 3, 11},
+  {0, 0, 0, 0},
+  {7, 8, 9, 8},
+  {0, 8, 9, 8},
+  {7, 8, 9, 8},
+  {0, 8, 9, 8},
+  {4, 5, 12, 11},
+  {0, 5, 11, 11},
+  {2, 3, 14, 13},
+  {0, 3, 13, 13},
+  {1, 2, 12, 13},
+  {0, 2, 14, 14},
+  {5, 8, 5, 4},
+  {4, 7, 7, 4},
+  {5, 8, 3, 2},
+  {8, 7, 3, 2},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {7, 0, 9, 9},
+  {0, 0, 9, 9},
+  {7, 0, 9, 9},
+  {0, 0, 9, 9},
+  {4, 0, 12, 13},
+  {0, 0, 12, 11},
+  {2, 0, 14, 15},
+  {0, 0, 14, 13},
+  {1, 0, 14, 16},
+  {1, 0, 14, 14},
+  {6, 9, 5, 3},
+  {6, 8, 6, 4},
+  {5, 10, 3, 2},
+  {10, 9, 3, 2},
+  {0, 0, 0, 0},
+  {0, 0, 0, 0},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 6, 16},
+  {10, 0, 6, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 4, 16, 12},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+  {0, 0, 16, 16},
+};
@@ -0,0 +1,55 @@
+# Generates sprite_bboxes.h, the opaque bounding box of every 16x16 cell
+# of the game spritesheet, used by the native riv_get_sprite_bbox.
+# Usage: python3 sprite_bboxes.py ../simple_dungeon_crawler_16x16.png > sprite_bboxes.h
+import struct, sys, zlib
+
+CELL = 16
+
+def read_png(path):
+    data = open(path, 'rb').read()
+    pos, idat, trns = 8, b'', b''
+    while pos < len(data):
+        size, kind = struct.unpack('>I4s', data[pos:pos+8])
+        chunk = data[pos+8:pos+8+size]
+        if kind == b'IHDR':
+            width, height, depth, color = struct.unpack('>IIBB', chunk[:10])
+            assert depth == 8 and color == 3, 'expected an 8-bit indexed png'
+        elif kind == b'tRNS':
+            trns = chunk
+        elif kind == b'IDAT':
+            idat += chunk
+        pos += 12 + size
+    raw = zlib.decompress(idat)
+    rows, prev = [], bytearray(width)
+    for y in range(height):
+        line = raw[y*(width+1):(y+1)*(width+1)]
+        kind, row = line[0], bytearray(line[1:])
+        for x in range(width):
+            a = row[x-1] if x > 0 else 0
+            b = prev[x]
+            c = prev[x-1] if x > 0 else 0
+            if kind == 1: row[x] = (row[x] + a) & 255
+            elif kind == 2: row[x] = (row[x] + b) & 255
+            elif kind == 3: row[x] = (row[x] + (a + b) // 2) & 255
+            elif kind == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                row[x] = (row[x] + (a if pa <= pb and pa <= pc else b if pb <= pc else c)) & 255
+        rows.append(row)
+        prev = row
+    opaque = lambda i: i >= len(trns) or trns[i] != 0
+    return width, height, [[opaque(i) for i in row] for row in rows]
+
+width, height, opaque = read_png(sys.argv[1])
+print('// generated by sprite_bboxes.py, do not edit')
+print('static const unsigned char sprite_bboxes[][4] = {')
+for cy in range(height // CELL):
+    for cx in range(width // CELL):
+        xs = [x for y in range(CELL) for x in range(CELL) if opaque[cy*CELL+y][cx*CELL+x]]
+        ys = [y for y in range(CELL) for x in range(CELL) if opaque[cy*CELL+y][cx*CELL+x]]
+        if xs:
+            box = (min(xs), min(ys), max(xs) - min(xs) + 1, max(ys) - min(ys) + 1)
+        else:
+            box = (0, 0, 0, 0)
+        print('  {%d, %d, %d, %d},' % box)
+print('};')
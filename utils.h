@@ -49,6 +49,33 @@ static inline vec2 make_vec2(f64 v) { return (vec2){v, v}; }
 static inline f64 sum_vec2(vec2 v) { return v.x + v.y; }
 static inline f64 distsqr_vec2(vec2 a, vec2 b) { return sum_vec2(sqr_vec2(sub_vec2(a, b))); }
 
+// fixed point with 8 fractional bits, such values fit exactly in vec2 floats
+typedef i64 fx;
+enum { FX_BITS = 8, FX_ONE = 1 << FX_BITS };
+static inline fx fx_from(f64 x) { return (fx)(x*FX_ONE + (x >= 0 ? 0.5 : -0.5)); }
+static inline f64 fx_to(fx x) { return (f64)x / FX_ONE; }
+static inline fx fx_mul(fx a, fx b) { return a*b / FX_ONE; }
+static inline u64 isqrt(u64 x) {
+  u64 r = 0, bit = (u64)1 << 62;
+  while (bit > x) bit >>= 2;
+  for (; bit != 0; bit >>= 2) {
+    if (x >= r + bit) { x -= r + bit; r = (r >> 1) + bit; } else { r >>= 1; }
+  }
+  return r;
+}
+// sine of a phase in 1/256 turns
+static const u16 fx_sin_quarter[65] = {
+  0, 6, 13, 19, 25, 31, 38, 44, 50, 56, 62, 68, 74, 80, 86, 92, 98, 104, 109, 115, 121, 126,
+  132, 137, 142, 147, 152, 157, 162, 167, 172, 177, 181, 185, 190, 194, 198, 202, 206, 209,
+  213, 216, 220, 223, 226, 229, 231, 234, 237, 239, 241, 243, 245, 247, 248, 250, 251, 252,
+  253, 254, 255, 255, 256, 256, 256,
+};
+static inline fx fx_sin(u64 phase) {
+  phase &= 255;
+  fx v = fx_sin_quarter[(phase & 64) ? 64 - (phase & 63) : (phase & 63)];
+  return phase >= 128 ? -v : v;
+}
+
 // recti
 static inline recti expand_recti(recti r, i64 b) { return (recti){r.x - b, r.y - b, r.width + 2*b, r.height + 2*b}; }
 static inline bool overlaps_recti(recti a, recti b) { return a.x + a.width > b.x && b.x + b.width > a.x && a.y + a.height > b.y && b.y + b.height > a.y; }